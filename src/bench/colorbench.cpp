@@ -0,0 +1,113 @@
+// Throughput of the ColorConvert kernels, every kernel is also checked
+// against the scalar one.
+//
+// usage: colorbench [width height [iterations]]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "colorconvert.hpp"
+
+struct Case
+{
+    const char *name;
+    uint32_t pixelFormat;
+    // source bytes per pixel times two
+    uint32_t srcBytes2;
+};
+
+int main(int argc, char *argv[])
+{
+    uint32_t width = 1280;
+    uint32_t height = 800;
+    int iterations = 200;
+    if (argc >= 3) {
+        width = std::strtoul(argv[1], nullptr, 0) & ~1u;
+        height = std::strtoul(argv[2], nullptr, 0) & ~1u;
+    }
+    if (argc >= 4) {
+        iterations = std::atoi(argv[3]);
+    }
+    if (width == 0 || height == 0 || iterations <= 0) {
+        std::cerr << "usage: " << argv[0] << " [width height [iterations]]"
+                  << std::endl;
+        return -1;
+    }
+
+    const Case cases[] = {
+        {"yuyv->rgba", V4L2_PIX_FMT_YUYV, 4},
+        {"uyvy->rgba", V4L2_PIX_FMT_UYVY, 4},
+        {"nv12->rgba", V4L2_PIX_FMT_NV12, 3},
+        {"rgba->bgra", V4L2_PIX_FMT_XBGR32, 8},
+    };
+    const ColorConvert::Isa isas[] = {
+        ColorConvert::Isa::Scalar, ColorConvert::Isa::SSE2,
+        ColorConvert::Isa::AVX2, ColorConvert::Isa::NEON,
+    };
+
+    std::mt19937 random(1);
+    size_t dstSize = static_cast<size_t>(width) * height * 4;
+    std::vector<uint8_t> reference(dstSize);
+    std::vector<uint8_t> dst(dstSize);
+    int failures = 0;
+
+    std::cout << width << "x" << height << ", " << iterations
+              << " iterations, best: "
+              << ColorConvert::isaName(ColorConvert::bestIsa()) << std::endl;
+
+    for (const Case &c : cases) {
+        size_t bytesPerLine = width * (c.srcBytes2 == 3 ? 1 : c.srcBytes2 / 2);
+        size_t srcSize = static_cast<size_t>(width) * height * c.srcBytes2 / 2;
+        std::vector<uint8_t> src(srcSize);
+        for (auto &byte : src) {
+            byte = random();
+        }
+
+        ColorConvert(ColorConvert::Isa::Scalar).toRgba(
+            c.pixelFormat, src.data(), bytesPerLine, reference.data(),
+            width, height);
+
+        for (ColorConvert::Isa isa : isas) {
+            if (!ColorConvert::supported(isa)) {
+                continue;
+            }
+
+            ColorConvert convert(isa);
+            std::memset(dst.data(), 0, dst.size());
+            convert.toRgba(c.pixelFormat, src.data(), bytesPerLine,
+                           dst.data(), width, height);
+            bool match = dst == reference;
+            if (!match) {
+                failures++;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++) {
+                convert.toRgba(c.pixelFormat, src.data(), bytesPerLine,
+                               dst.data(), width, height);
+            }
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            // bytes read plus bytes written
+            double bytes = static_cast<double>(srcSize + dstSize) * iterations;
+            std::cout << std::left << std::setw(12) << c.name
+                      << std::setw(8) << ColorConvert::isaName(isa)
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(8) << bytes / elapsed.count() / 1e9
+                      << " GB/s" << std::setw(10)
+                      << elapsed.count() * 1e3 / iterations << " ms"
+                      << (match ? "" : "  MISMATCH") << std::endl;
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
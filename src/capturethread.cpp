@@ -0,0 +1,110 @@
+#include "capturethread.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+CaptureThread::CaptureThread(FrameSource &capture,
+                             const std::function<void()> &notify) :
+    m_capture(capture),
+    m_notify(notify)
+{
+    m_stopFd = eventfd(0, EFD_CLOEXEC);
+    if (m_stopFd == -1) {
+        throw std::runtime_error("eventfd failed");
+    }
+}
+
+CaptureThread::~CaptureThread()
+{
+    stop();
+    ::close(m_stopFd);
+}
+
+void CaptureThread::start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    m_thread = std::thread(&CaptureThread::run, this);
+}
+
+void CaptureThread::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    uint64_t value = 1;
+    if (::write(m_stopFd, &value, sizeof(value)) != sizeof(value)) {
+        std::cerr << "failed to stop capture thread" << std::endl;
+    }
+    m_thread.join();
+}
+
+bool CaptureThread::takeLatest(Frame &frame)
+{
+    Frame next;
+    bool found = false;
+
+    while (m_queue.pop(next)) {
+        if (found) {
+            StreamStats::add(m_capture.stats().superseded);
+            m_capture.doneFrame(frame.index);
+        }
+        frame = next;
+        found = true;
+    }
+
+    return found;
+}
+
+void CaptureThread::run()
+{
+    struct pollfd fds[2] = {};
+    fds[0].fd = m_capture.fd();
+    fds[0].events = POLLIN;
+    fds[1].fd = m_stopFd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "capture poll failed: " << errno << std::endl;
+            return;
+        }
+
+        if (fds[1].revents) {
+            return;
+        }
+
+        if (fds[0].revents & POLLERR) {
+            std::cerr << "capture device error" << std::endl;
+            return;
+        }
+
+        bool queued = false;
+        Frame frame;
+        while ((frame = m_capture.readFrame()).index != -1) {
+            if (m_queue.push(frame)) {
+                queued = true;
+            } else {
+                // the render thread is behind by a whole queue
+                StreamStats::add(m_capture.stats().superseded);
+                m_capture.doneFrame(frame.index);
+            }
+        }
+
+        if (queued && m_notify) {
+            m_notify();
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+
+#include "frame.hpp"
+#include "spscqueue.hpp"
+#include "framesource.hpp"
+
+// Dequeues frames of one FrameSource on its own thread, blocking in poll().
+class CaptureThread
+{
+public:
+    // notify is called on the capture thread after each queued frame
+    CaptureThread(FrameSource &capture, const std::function<void()> &notify);
+    virtual ~CaptureThread();
+
+    void start();
+    void stop();
+    // newest queued frame, older ones are handed back to the driver
+    bool takeLatest(Frame &frame);
+
+private:
+    FrameSource &m_capture;
+    std::function<void()> m_notify;
+    SpscQueue<Frame, 8> m_queue;
+    std::thread m_thread;
+    int m_stopFd = -1;
+
+    void run();
+};
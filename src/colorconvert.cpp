@@ -0,0 +1,571 @@
+#include "colorconvert.hpp"
+
+#include <linux/videodev2.h>
+
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLORCONVERT_X86
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON)
+#define COLORCONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// BT.601 limited range in 6 bit fixed point:
+//   luma = 74.5 * (y - 16) + 32
+//   r = (luma + 102 * v) >> 6
+//   g = (luma - 25 * u - 52 * v) >> 6
+//   b = (luma + 129 * u) >> 6
+// every intermediate fits in int16, except b which only saturates when the
+// result clamps to 255 anyway, so the SIMD kernels match bit for bit.
+
+inline uint8_t clamp8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+inline void yuvPixel(int y, int u, int v, uint8_t *dst)
+{
+    int luma = 74 * (y - 16) + ((y - 16) >> 1) + 32;
+    u -= 128;
+    v -= 128;
+
+    dst[0] = clamp8((luma + 102 * v) >> 6);
+    dst[1] = clamp8((luma - 25 * u - 52 * v) >> 6);
+    dst[2] = clamp8((luma + 129 * u) >> 6);
+    dst[3] = 255;
+}
+
+void yuyvRowScalar(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    for (uint32_t x = 0; x + 1 < width; x += 2) {
+        yuvPixel(src[0], src[1], src[3], dst);
+        yuvPixel(src[2], src[1], src[3], dst + 4);
+        src += 4;
+        dst += 8;
+    }
+}
+
+void uyvyRowScalar(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    for (uint32_t x = 0; x + 1 < width; x += 2) {
+        yuvPixel(src[1], src[0], src[2], dst);
+        yuvPixel(src[3], src[0], src[2], dst + 4);
+        src += 4;
+        dst += 8;
+    }
+}
+
+void nv12RowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                   uint32_t width)
+{
+    for (uint32_t x = 0; x + 1 < width; x += 2) {
+        yuvPixel(y[x], uv[x], uv[x + 1], dst);
+        yuvPixel(y[x + 1], uv[x], uv[x + 1], dst + 4);
+        dst += 8;
+    }
+}
+
+void swizzleRowScalar(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++) {
+        uint8_t first = src[0];
+        uint8_t third = src[2];
+        dst[0] = third;
+        dst[1] = src[1];
+        dst[2] = first;
+        dst[3] = src[3];
+        src += 4;
+        dst += 4;
+    }
+}
+
+const ColorConvert::Kernels scalarKernels = {
+    yuyvRowScalar, uyvyRowScalar, nv12RowScalar, swizzleRowScalar
+};
+
+#ifdef COLORCONVERT_X86
+
+// y, u and v hold one int16 per pixel, writes 8 RGBA pixels
+SSE2_TARGET inline void yuvToRgbaSse2(__m128i y, __m128i u, __m128i v,
+                                      uint8_t *dst)
+{
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    __m128i luma = _mm_add_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(74)),
+                      _mm_srai_epi16(y, 1)),
+        _mm_set1_epi16(32));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    __m128i r = _mm_srai_epi16(
+        _mm_adds_epi16(luma, _mm_mullo_epi16(v, _mm_set1_epi16(102))), 6);
+    __m128i g = _mm_srai_epi16(
+        _mm_subs_epi16(
+            _mm_subs_epi16(luma, _mm_mullo_epi16(u, _mm_set1_epi16(25))),
+            _mm_mullo_epi16(v, _mm_set1_epi16(52))), 6);
+    __m128i b = _mm_srai_epi16(
+        _mm_adds_epi16(luma, _mm_mullo_epi16(u, _mm_set1_epi16(129))), 6);
+
+    __m128i rb = _mm_packus_epi16(r, b);
+    __m128i ga = _mm_packus_epi16(g, _mm_set1_epi16(255));
+    __m128i rg = _mm_unpacklo_epi8(rb, ga);
+    __m128i ba = _mm_unpackhi_epi8(rb, ga);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+                     _mm_unpackhi_epi16(rg, ba));
+}
+
+// uv holds interleaved u0 v0 u1 v1 ..., splits it into one value per pixel
+SSE2_TARGET inline void splitChromaSse2(__m128i uv, __m128i &u, __m128i &v)
+{
+    u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+                            _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+                            _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+SSE2_TARGET void yuyvRowSse2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    uint32_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i pixels = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + x * 2));
+        __m128i u, v;
+        splitChromaSse2(_mm_srli_epi16(pixels, 8), u, v);
+        yuvToRgbaSse2(_mm_and_si128(pixels, lowBytes), u, v, dst + x * 4);
+    }
+    yuyvRowScalar(src + x * 2, dst + x * 4, width - x);
+}
+
+SSE2_TARGET void uyvyRowSse2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    uint32_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i pixels = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + x * 2));
+        __m128i u, v;
+        splitChromaSse2(_mm_and_si128(pixels, lowBytes), u, v);
+        yuvToRgbaSse2(_mm_srli_epi16(pixels, 8), u, v, dst + x * 4);
+    }
+    uyvyRowScalar(src + x * 2, dst + x * 4, width - x);
+}
+
+SSE2_TARGET void nv12RowSse2(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                             uint32_t width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i luma = _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + x)), zero);
+        __m128i chroma = _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(uv + x)), zero);
+        __m128i u, v;
+        splitChromaSse2(chroma, u, v);
+        yuvToRgbaSse2(luma, u, v, dst + x * 4);
+    }
+    nv12RowScalar(y + x, uv + x, dst + x * 4, width - x);
+}
+
+SSE2_TARGET void swizzleRowSse2(const uint8_t *src, uint8_t *dst,
+                                uint32_t width)
+{
+    const __m128i greenAlpha = _mm_set1_epi32(0xff00ff00);
+    uint32_t x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src + x * 4));
+        __m128i redBlue = _mm_andnot_si128(greenAlpha, pixels);
+        redBlue = _mm_or_si128(_mm_srli_epi32(redBlue, 16),
+                               _mm_slli_epi32(redBlue, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4),
+                         _mm_or_si128(_mm_and_si128(pixels, greenAlpha),
+                                      redBlue));
+    }
+    swizzleRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+const ColorConvert::Kernels sse2Kernels = {
+    yuyvRowSse2, uyvyRowSse2, nv12RowSse2, swizzleRowSse2
+};
+
+// as yuvToRgbaSse2, 16 pixels, the 128 bit lanes hold pixels 0-7 and 8-15
+AVX2_TARGET inline void yuvToRgbaAvx2(__m256i y, __m256i u, __m256i v,
+                                      uint8_t *dst)
+{
+    y = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+    __m256i luma = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(y, _mm256_set1_epi16(74)),
+                         _mm256_srai_epi16(y, 1)),
+        _mm256_set1_epi16(32));
+    u = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+    v = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+    __m256i r = _mm256_srai_epi16(
+        _mm256_adds_epi16(luma,
+                          _mm256_mullo_epi16(v, _mm256_set1_epi16(102))), 6);
+    __m256i g = _mm256_srai_epi16(
+        _mm256_subs_epi16(
+            _mm256_subs_epi16(luma,
+                              _mm256_mullo_epi16(u, _mm256_set1_epi16(25))),
+            _mm256_mullo_epi16(v, _mm256_set1_epi16(52))), 6);
+    __m256i b = _mm256_srai_epi16(
+        _mm256_adds_epi16(luma,
+                          _mm256_mullo_epi16(u, _mm256_set1_epi16(129))), 6);
+
+    __m256i rb = _mm256_packus_epi16(r, b);
+    __m256i ga = _mm256_packus_epi16(g, _mm256_set1_epi16(255));
+    __m256i rg = _mm256_unpacklo_epi8(rb, ga);
+    __m256i ba = _mm256_unpackhi_epi8(rb, ga);
+    __m256i low = _mm256_unpacklo_epi16(rg, ba);
+    __m256i high = _mm256_unpackhi_epi16(rg, ba);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst),
+                        _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32),
+                        _mm256_permute2x128_si256(low, high, 0x31));
+}
+
+AVX2_TARGET inline void splitChromaAvx2(__m256i uv, __m256i &u, __m256i &v)
+{
+    u = _mm256_shufflehi_epi16(
+        _mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+        _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm256_shufflehi_epi16(
+        _mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+        _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+AVX2_TARGET void yuyvRowAvx2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    const __m256i lowBytes = _mm256_set1_epi16(0xff);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i pixels = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + x * 2));
+        __m256i u, v;
+        splitChromaAvx2(_mm256_srli_epi16(pixels, 8), u, v);
+        yuvToRgbaAvx2(_mm256_and_si256(pixels, lowBytes), u, v, dst + x * 4);
+    }
+    yuyvRowSse2(src + x * 2, dst + x * 4, width - x);
+}
+
+AVX2_TARGET void uyvyRowAvx2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    const __m256i lowBytes = _mm256_set1_epi16(0xff);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i pixels = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + x * 2));
+        __m256i u, v;
+        splitChromaAvx2(_mm256_and_si256(pixels, lowBytes), u, v);
+        yuvToRgbaAvx2(_mm256_srli_epi16(pixels, 8), u, v, dst + x * 4);
+    }
+    uyvyRowSse2(src + x * 2, dst + x * 4, width - x);
+}
+
+AVX2_TARGET void nv12RowAvx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                             uint32_t width)
+{
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i luma = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x)));
+        __m256i chroma = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x)));
+        __m256i u, v;
+        splitChromaAvx2(chroma, u, v);
+        yuvToRgbaAvx2(luma, u, v, dst + x * 4);
+    }
+    nv12RowSse2(y + x, uv + x, dst + x * 4, width - x);
+}
+
+AVX2_TARGET void swizzleRowAvx2(const uint8_t *src, uint8_t *dst,
+                                uint32_t width)
+{
+    const __m256i order = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    uint32_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m256i pixels = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + x * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x * 4),
+                            _mm256_shuffle_epi8(pixels, order));
+    }
+    swizzleRowSse2(src + x * 4, dst + x * 4, width - x);
+}
+
+const ColorConvert::Kernels avx2Kernels = {
+    yuyvRowAvx2, uyvyRowAvx2, nv12RowAvx2, swizzleRowAvx2
+};
+
+#endif
+
+#ifdef COLORCONVERT_NEON
+
+inline int16x8_t widenNeon(uint8x8_t value)
+{
+    return vreinterpretq_s16_u16(vmovl_u8(value));
+}
+
+inline void yuvToRgbNeon(int16x8_t y, int16x8_t u, int16x8_t v,
+                         uint8x8_t &r, uint8x8_t &g, uint8x8_t &b)
+{
+    y = vsubq_s16(y, vdupq_n_s16(16));
+    int16x8_t luma = vaddq_s16(vaddq_s16(vmulq_n_s16(y, 74), vshrq_n_s16(y, 1)),
+                               vdupq_n_s16(32));
+    u = vsubq_s16(u, vdupq_n_s16(128));
+    v = vsubq_s16(v, vdupq_n_s16(128));
+
+    r = vqshrun_n_s16(vqaddq_s16(luma, vmulq_n_s16(v, 102)), 6);
+    g = vqshrun_n_s16(vqsubq_s16(vqsubq_s16(luma, vmulq_n_s16(u, 25)),
+                                 vmulq_n_s16(v, 52)), 6);
+    b = vqshrun_n_s16(vqaddq_s16(luma, vmulq_n_s16(u, 129)), 6);
+}
+
+// even and odd pixels share u and v, writes 16 RGBA pixels
+inline void yuvPairsToRgbaNeon(uint8x8_t evenY, uint8x8_t oddY,
+                               uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+    int16x8_t wideU = widenNeon(u);
+    int16x8_t wideV = widenNeon(v);
+    uint8x8_t evenR, evenG, evenB, oddR, oddG, oddB;
+    yuvToRgbNeon(widenNeon(evenY), wideU, wideV, evenR, evenG, evenB);
+    yuvToRgbNeon(widenNeon(oddY), wideU, wideV, oddR, oddG, oddB);
+
+    uint8x8x2_t r = vzip_u8(evenR, oddR);
+    uint8x8x2_t g = vzip_u8(evenG, oddG);
+    uint8x8x2_t b = vzip_u8(evenB, oddB);
+    uint8x16x4_t rgba;
+    rgba.val[0] = vcombine_u8(r.val[0], r.val[1]);
+    rgba.val[1] = vcombine_u8(g.val[0], g.val[1]);
+    rgba.val[2] = vcombine_u8(b.val[0], b.val[1]);
+    rgba.val[3] = vdupq_n_u8(255);
+    vst4q_u8(dst, rgba);
+}
+
+void yuyvRowNeon(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x4_t pixels = vld4_u8(src + x * 2);
+        yuvPairsToRgbaNeon(pixels.val[0], pixels.val[2],
+                           pixels.val[1], pixels.val[3], dst + x * 4);
+    }
+    yuyvRowScalar(src + x * 2, dst + x * 4, width - x);
+}
+
+void uyvyRowNeon(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x4_t pixels = vld4_u8(src + x * 2);
+        yuvPairsToRgbaNeon(pixels.val[1], pixels.val[3],
+                           pixels.val[0], pixels.val[2], dst + x * 4);
+    }
+    uyvyRowScalar(src + x * 2, dst + x * 4, width - x);
+}
+
+void nv12RowNeon(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                 uint32_t width)
+{
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x2_t luma = vld2_u8(y + x);
+        uint8x8x2_t chroma = vld2_u8(uv + x);
+        yuvPairsToRgbaNeon(luma.val[0], luma.val[1],
+                           chroma.val[0], chroma.val[1], dst + x * 4);
+    }
+    nv12RowScalar(y + x, uv + x, dst + x * 4, width - x);
+}
+
+void swizzleRowNeon(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t pixels = vld4q_u8(src + x * 4);
+        uint8x16_t first = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = first;
+        vst4q_u8(dst + x * 4, pixels);
+    }
+    swizzleRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+const ColorConvert::Kernels neonKernels = {
+    yuyvRowNeon, uyvyRowNeon, nv12RowNeon, swizzleRowNeon
+};
+
+#endif
+
+}
+
+ColorConvert::ColorConvert() :
+    ColorConvert(bestIsa())
+{
+}
+
+ColorConvert::ColorConvert(Isa isa) :
+    m_isa(isa)
+{
+    if (!supported(isa)) {
+        throw std::runtime_error(std::string(isaName(isa)) +
+                                 " is not supported by this cpu");
+    }
+
+    switch (isa) {
+#ifdef COLORCONVERT_X86
+    case Isa::SSE2:
+        m_kernels = sse2Kernels;
+        break;
+    case Isa::AVX2:
+        m_kernels = avx2Kernels;
+        break;
+#endif
+#ifdef COLORCONVERT_NEON
+    case Isa::NEON:
+        m_kernels = neonKernels;
+        break;
+#endif
+    default:
+        m_kernels = scalarKernels;
+        break;
+    }
+}
+
+ColorConvert::Isa ColorConvert::bestIsa()
+{
+    for (Isa isa : {Isa::AVX2, Isa::SSE2, Isa::NEON}) {
+        if (supported(isa)) {
+            return isa;
+        }
+    }
+    return Isa::Scalar;
+}
+
+bool ColorConvert::supported(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return true;
+#ifdef COLORCONVERT_X86
+    case Isa::SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case Isa::AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef COLORCONVERT_NEON
+    // part of the armv8 baseline, armv7 builds only get here with -mfpu=neon
+    case Isa::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char *ColorConvert::isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::SSE2:
+        return "sse2";
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::NEON:
+        return "neon";
+    }
+    return "unknown";
+}
+
+void ColorConvert::yuyvToRgba(const uint8_t *src, size_t srcStride,
+                              uint8_t *dst, size_t dstStride,
+                              uint32_t width, uint32_t height) const
+{
+    for (uint32_t row = 0; row < height; row++) {
+        m_kernels.yuyvRow(src + row * srcStride, dst + row * dstStride, width);
+    }
+}
+
+void ColorConvert::uyvyToRgba(const uint8_t *src, size_t srcStride,
+                              uint8_t *dst, size_t dstStride,
+                              uint32_t width, uint32_t height) const
+{
+    for (uint32_t row = 0; row < height; row++) {
+        m_kernels.uyvyRow(src + row * srcStride, dst + row * dstStride, width);
+    }
+}
+
+void ColorConvert::nv12ToRgba(const uint8_t *y, size_t yStride,
+                              const uint8_t *uv, size_t uvStride,
+                              uint8_t *dst, size_t dstStride,
+                              uint32_t width, uint32_t height) const
+{
+    for (uint32_t row = 0; row < height; row++) {
+        m_kernels.nv12Row(y + row * yStride, uv + (row / 2) * uvStride,
+                          dst + row * dstStride, width);
+    }
+}
+
+void ColorConvert::rgbaToBgra(const uint8_t *src, size_t srcStride,
+                              uint8_t *dst, size_t dstStride,
+                              uint32_t width, uint32_t height) const
+{
+    for (uint32_t row = 0; row < height; row++) {
+        m_kernels.swizzleRow(src + row * srcStride, dst + row * dstStride,
+                             width);
+    }
+}
+
+void ColorConvert::toRgba(uint32_t pixelFormat, const uint8_t *src,
+                          size_t bytesPerLine, uint8_t *dst,
+                          uint32_t width, uint32_t height) const
+{
+    size_t dstStride = static_cast<size_t>(width) * 4;
+
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_XBGR32:
+        rgbaToBgra(src, bytesPerLine, dst, dstStride, width, height);
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        yuyvToRgba(src, bytesPerLine, dst, dstStride, width, height);
+        break;
+    case V4L2_PIX_FMT_UYVY:
+        uyvyToRgba(src, bytesPerLine, dst, dstStride, width, height);
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+        nv12ToRgba(src, bytesPerLine, src + bytesPerLine * height,
+                   bytesPerLine, dst, dstStride, width, height);
+        break;
+    default:
+        throw std::runtime_error("unsupported pixel format");
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU conversion of captured frames to RGBA bytes, for formats the GPU can
+// not sample and for CPU consumers. YUV is BT.601 limited range like
+// yuv.glsl, all kernels give bit identical results to the scalar one.
+class ColorConvert
+{
+public:
+    enum class Isa
+    {
+        Scalar,
+        SSE2,
+        AVX2,
+        NEON,
+    };
+
+    // picks the best kernels the CPU supports
+    ColorConvert();
+    // throws if the CPU does not support isa
+    explicit ColorConvert(Isa isa);
+
+    static Isa bestIsa();
+    static bool supported(Isa isa);
+    static const char *isaName(Isa isa);
+    Isa isa() const
+    {
+        return m_isa;
+    }
+
+    // width has to be even for the YUV formats, strides are in bytes
+    void yuyvToRgba(const uint8_t *src, size_t srcStride,
+                    uint8_t *dst, size_t dstStride,
+                    uint32_t width, uint32_t height) const;
+    void uyvyToRgba(const uint8_t *src, size_t srcStride,
+                    uint8_t *dst, size_t dstStride,
+                    uint32_t width, uint32_t height) const;
+    void nv12ToRgba(const uint8_t *y, size_t yStride,
+                    const uint8_t *uv, size_t uvStride,
+                    uint8_t *dst, size_t dstStride,
+                    uint32_t width, uint32_t height) const;
+    // swaps bytes 0 and 2 of every pixel, works both ways
+    void rgbaToBgra(const uint8_t *src, size_t srcStride,
+                    uint8_t *dst, size_t dstStride,
+                    uint32_t width, uint32_t height) const;
+
+    // converts a frame laid out as V4l2Capture writes it (NV12 chroma right
+    // after the luma plane) into tightly packed RGBA, XBGR32 is swizzled
+    void toRgba(uint32_t pixelFormat, const uint8_t *src, size_t bytesPerLine,
+                uint8_t *dst, uint32_t width, uint32_t height) const;
+
+    struct Kernels
+    {
+        void (*yuyvRow)(const uint8_t *src, uint8_t *dst, uint32_t width);
+        void (*uyvyRow)(const uint8_t *src, uint8_t *dst, uint32_t width);
+        void (*nv12Row)(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                        uint32_t width);
+        void (*swizzleRow)(const uint8_t *src, uint8_t *dst, uint32_t width);
+    };
+
+private:
+    Isa m_isa;
+    Kernels m_kernels;
+};
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "yuv.glsl"
+
+// one linear image per imported capture buffer
+layout(constant_id = 0) const int TEXTURE_COUNT = 1;
+
+layout(binding = 1) uniform sampler2D texSamplers[TEXTURE_COUNT];
+
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) flat in int fragLayer;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    if (fragLayer < 0) {
+        outColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    if (FORMAT == FORMAT_RGBA) {
+        outColor = texture(texSamplers[fragLayer], fragTexCoord);
+    } else {
+        ivec2 size = textureSize(texSamplers[fragLayer], 0) * ivec2(2, 1);
+        ivec2 pos = clamp(ivec2(fragTexCoord * vec2(size)),
+                          ivec2(0), size - 1);
+        vec4 texel = texelFetch(texSamplers[fragLayer],
+                                ivec2(pos.x / 2, pos.y), 0);
+        outColor = vec4(unpack422(texel, pos.x), 1.0);
+    }
+}
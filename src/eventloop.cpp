@@ -0,0 +1,92 @@
+#include "eventloop.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+static const uint32_t WAKEUP_ID = std::numeric_limits<uint32_t>::max();
+
+EventLoop::EventLoop()
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd == -1) {
+        throw std::runtime_error("epoll_create1 failed");
+    }
+
+    m_wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeupFd == -1) {
+        ::close(m_epollFd);
+        throw std::runtime_error("eventfd failed");
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = WAKEUP_ID;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &event)) {
+        ::close(m_wakeupFd);
+        ::close(m_epollFd);
+        throw std::runtime_error("epoll_ctl failed");
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    ::close(m_wakeupFd);
+    ::close(m_epollFd);
+}
+
+void EventLoop::add(int fd, const Handler &handler)
+{
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = m_handlers.size();
+
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event)) {
+        throw std::runtime_error("epoll_ctl failed");
+    }
+
+    m_handlers.push_back(handler);
+}
+
+void EventLoop::wakeup()
+{
+    uint64_t value = 1;
+    ssize_t ret = ::write(m_wakeupFd, &value, sizeof(value));
+    (void)ret;
+}
+
+int EventLoop::runOnce(int timeoutMs)
+{
+    std::array<struct epoll_event, 16> events;
+
+    int count = epoll_wait(m_epollFd, events.data(), events.size(), timeoutMs);
+    if (count == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw std::runtime_error("epoll_wait failed");
+    }
+
+    int handled = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t id = events[i].data.u32;
+
+        if (id == WAKEUP_ID) {
+            uint64_t value;
+            ssize_t ret = ::read(m_wakeupFd, &value, sizeof(value));
+            (void)ret;
+            continue;
+        }
+
+        m_handlers.at(id)();
+        handled++;
+    }
+
+    return handled;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+// Single threaded epoll reactor.
+class EventLoop
+{
+public:
+    using Handler = std::function<void()>;
+
+    EventLoop();
+    virtual ~EventLoop();
+
+    // handler runs on the loop thread whenever fd is readable
+    void add(int fd, const Handler &handler);
+    // makes a blocked runOnce() return, async-signal-safe
+    void wakeup();
+    // waits up to timeoutMs (-1 forever) and dispatches ready handlers,
+    // returns the number of handlers run
+    int runOnce(int timeoutMs);
+
+private:
+    int m_epollFd = -1;
+    int m_wakeupFd = -1;
+    std::vector<Handler> m_handlers;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <time.h>
+
+// One dequeued capture buffer, carried from V4l2Capture::readFrame() through
+// Render until the GPU is done with it. Times are CLOCK_MONOTONIC in ns.
+struct Frame
+{
+    int index = -1;
+    uint32_t sequence = 0;
+    // payload of all planes
+    uint32_t bytesUsed = 0;
+    // driver timestamp, 0 if the driver does not use the monotonic clock
+    uint64_t captureTime = 0;
+    // when the buffer was dequeued
+    uint64_t dequeueTime = 0;
+    // when Render submitted the upload (or latched the dmabuf)
+    uint64_t submitTime = 0;
+};
+
+inline uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,14 @@
+#include "framesource.hpp"
+
+void FrameSource::countFrame(uint32_t sequence)
+{
+    uint32_t gap = sequence - m_lastSequence - 1;
+
+    // a sequence going backwards is a restart rather than a huge gap
+    if (m_haveSequence && gap != 0 && gap < 0x80000000u) {
+        StreamStats::add(m_stats.dropped, gap);
+    }
+    m_lastSequence = sequence;
+    m_haveSequence = true;
+    StreamStats::add(m_stats.dequeued);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <linux/videodev2.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "frame.hpp"
+#include "streamstats.hpp"
+
+// Anything that fills caller provided buffers with frames: a V4L2 camera or
+// a synthetic stream. readFrame() runs on the capture thread, doneFrame()
+// on the capture or render thread.
+class FrameSource
+{
+public:
+    enum class PixFormat
+    {
+        XBGR32 = V4L2_PIX_FMT_XBGR32,
+        YUYV = V4L2_PIX_FMT_YUYV,
+        UYVY = V4L2_PIX_FMT_UYVY,
+        NV12 = V4L2_PIX_FMT_NV12,
+        NV12M = V4L2_PIX_FMT_NV12M,
+    };
+
+    struct ImgFormat
+    {
+        int width;
+        int height;
+        PixFormat m_pixFmt;
+
+        ImgFormat(int width = -1, int height = -1,
+                  PixFormat pixFmt = PixFormat::XBGR32) :
+            width(width),
+            height(height),
+            m_pixFmt(pixFmt)
+        {}
+    };
+
+    struct Buffer
+    {
+        void *start;
+        size_t length;
+
+        Buffer(void *start_ = nullptr, size_t length_ = 0) :
+            start(start_),
+            length(length_)
+        {}
+
+        Buffer& operator=(const Buffer& other)
+        {
+            if (this != &other) {
+                start = other.start;
+                length = other.length;
+            }
+            return *this;
+        }
+    };
+
+    // V4L2 limit, also what the sources' free buffer masks hold
+    static constexpr size_t MAX_BUFFERS = VIDEO_MAX_FRAME;
+
+    virtual ~FrameSource() {}
+
+    // frames are written into the caller's buffers, e.g. the staging slots
+    // of Render::getBufferAddrs(), 2 to MAX_BUFFERS of them
+    virtual void open(const std::string &path, const ImgFormat &imgFormat,
+                      const std::vector<Buffer> &buffers) = 0;
+    // readable when readFrame() may return a frame
+    virtual int fd() const = 0;
+    virtual uint32_t bytesPerLine() const = 0;
+    virtual int frameSize() const = 0;
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    // index -1 when no buffer is ready
+    virtual Frame readFrame() = 0;
+    // hands buffer index back to the source
+    virtual void doneFrame(int index) = 0;
+
+    // dequeued and dropped are counted by the source, the rest by the
+    // consumers of the frames
+    virtual StreamStats &stats()
+    {
+        return m_stats;
+    }
+
+protected:
+    // restarts the sequence numbering, e.g. at STREAMON
+    void resetSequence()
+    {
+        m_haveSequence = false;
+    }
+    // counts a dequeued frame and the sequence numbers skipped before it
+    void countFrame(uint32_t sequence);
+
+private:
+    StreamStats m_stats;
+    bool m_haveSequence = false;
+    uint32_t m_lastSequence = 0;
+};
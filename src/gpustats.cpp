@@ -0,0 +1,42 @@
+#include "gpustats.hpp"
+
+#include <iomanip>
+
+static const char *stageNames[GpuStats::STAGE_COUNT] = {
+    "upload",
+    "upload/camera",
+    "acquire",
+    "draw",
+    "readback",
+};
+
+void GpuStats::reset()
+{
+    for (auto &histogram : m_histograms) {
+        histogram.reset();
+    }
+}
+
+void GpuStats::print(std::ostream &out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(1);
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        const Histogram &histogram = m_histograms[stage];
+        if (histogram.count() == 0) {
+            continue;
+        }
+
+        out << "gpu " << std::left << std::setw(15) << stageNames[stage]
+            << std::right
+            << " n " << std::setw(6) << histogram.count()
+            << "  p50 " << std::setw(8) << histogram.percentile(50) / 1e3
+            << "  p99 " << std::setw(8) << histogram.percentile(99) / 1e3
+            << "  max " << std::setw(8) << histogram.max() / 1e3
+            << " us" << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#include "histogram.hpp"
+
+// GPU time of each part of a frame, from timestamp queries read back once
+// the frame retired. Only used from the render thread.
+class GpuStats
+{
+public:
+    enum Stage
+    {
+        // staging copies and layout barriers of all cameras uploaded in
+        // the frame, on the transfer queue when there is a dedicated one
+        Upload,
+        // Upload divided by the cameras it copied
+        UploadPerCamera,
+        // dedicated transfer: the graphics queue taking over the layers
+        Acquire,
+        // the mosaic render pass
+        Draw,
+        // copy of the rendered image into a readback buffer
+        Readback,
+        STAGE_COUNT
+    };
+
+    void record(Stage stage, uint64_t ns)
+    {
+        m_histograms[stage].record(ns);
+    }
+    void reset();
+    // p50/p99/max in us per stage
+    void print(std::ostream &out) const;
+
+private:
+    std::array<Histogram, STAGE_COUNT> m_histograms;
+};
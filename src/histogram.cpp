@@ -0,0 +1,59 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void Histogram::record(uint64_t value)
+{
+    m_counts[bucketIndex(value)]++;
+    m_count++;
+    m_max = std::max(m_max, value);
+}
+
+void Histogram::reset()
+{
+    m_counts.fill(0);
+    m_count = 0;
+    m_max = 0;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(std::ceil(p / 100.0 * m_count));
+    target = std::max<uint64_t>(1, std::min(target, m_count));
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += m_counts[i];
+        if (seen >= target) {
+            return std::min(bucketValue(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+int Histogram::bucketIndex(uint64_t value)
+{
+    if (value < (1u << SUB_BITS)) {
+        return static_cast<int>(value);
+    }
+
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) +
+           static_cast<int>((value >> shift) - (1u << SUB_BITS));
+}
+
+uint64_t Histogram::bucketValue(int index)
+{
+    if (index < (1 << SUB_BITS)) {
+        return index;
+    }
+
+    int shift = (index >> SUB_BITS) - 1;
+    uint64_t sub = (index & ((1 << SUB_BITS) - 1)) + (1u << SUB_BITS);
+    return (sub << shift) + ((1ull << shift) - 1);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Log-linear histogram in the spirit of HdrHistogram: values below
+// 2^SUB_BITS are exact, above that every power of two is split into
+// 2^SUB_BITS linear buckets, so percentiles are within ~3% of the value.
+class Histogram
+{
+public:
+    void record(uint64_t value);
+    void reset();
+
+    // highest value of the bucket holding the p-th percentile, p in [0, 100]
+    uint64_t percentile(double p) const;
+    uint64_t count() const
+    {
+        return m_count;
+    }
+    uint64_t max() const
+    {
+        return m_max;
+    }
+
+private:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketValue(int index);
+
+    std::array<uint64_t, BUCKETS> m_counts = {};
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
@@ -0,0 +1,66 @@
+#include "latencystats.hpp"
+
+#include <iomanip>
+
+static const char *stageNames[LatencyStats::STAGE_COUNT] = {
+    "capture->dequeue",
+    "dequeue->submit",
+    "submit->gpu done",
+    "capture->gpu done",
+};
+
+void LatencyStats::resize(size_t cameraNum)
+{
+    m_histograms.resize(cameraNum);
+}
+
+void LatencyStats::record(int index, const Frame &frame, uint64_t doneTime)
+{
+    auto &histograms = m_histograms.at(index);
+
+    // drivers without monotonic timestamps leave captureTime at 0
+    if (frame.captureTime != 0 && frame.dequeueTime >= frame.captureTime) {
+        histograms[CaptureToDequeue].record(frame.dequeueTime -
+                                            frame.captureTime);
+        histograms[CaptureToGpuDone].record(doneTime - frame.captureTime);
+    }
+    histograms[DequeueToSubmit].record(frame.submitTime - frame.dequeueTime);
+    histograms[SubmitToGpuDone].record(doneTime - frame.submitTime);
+}
+
+void LatencyStats::reset()
+{
+    for (auto &camera : m_histograms) {
+        for (auto &histogram : camera) {
+            histogram.reset();
+        }
+    }
+}
+
+void LatencyStats::print(std::ostream &out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < m_histograms.size(); i++) {
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            const Histogram &histogram = m_histograms[i][stage];
+            if (histogram.count() == 0) {
+                continue;
+            }
+
+            out << "camera " << i << " " << std::left << std::setw(18)
+                << stageNames[stage] << std::right
+                << " n " << std::setw(6) << histogram.count()
+                << "  p50 " << std::setw(8) << histogram.percentile(50) / 1e3
+                << "  p99 " << std::setw(8) << histogram.percentile(99) / 1e3
+                << "  p999 " << std::setw(8)
+                << histogram.percentile(99.9) / 1e3
+                << "  max " << std::setw(8) << histogram.max() / 1e3
+                << " us" << std::endl;
+        }
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "frame.hpp"
+#include "histogram.hpp"
+
+// Per camera latency of the frame pipeline, recorded once the GPU is done
+// with a frame. Only used from the render thread.
+class LatencyStats
+{
+public:
+    enum Stage
+    {
+        // driver timestamp to VIDIOC_DQBUF
+        CaptureToDequeue,
+        // VIDIOC_DQBUF to the upload (or dmabuf latch) being submitted
+        DequeueToSubmit,
+        // submit to the frame fence observed signalled
+        SubmitToGpuDone,
+        CaptureToGpuDone,
+        STAGE_COUNT
+    };
+
+    void resize(size_t cameraNum);
+    void record(int index, const Frame &frame, uint64_t doneTime);
+    void reset();
+    // p50/p99/p999 in us per camera and stage
+    void print(std::ostream &out) const;
+
+private:
+    std::vector<std::array<Histogram, STAGE_COUNT>> m_histograms;
+};
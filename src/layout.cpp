@@ -0,0 +1,67 @@
+#include "layout.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+Layout Layout::grid(uint32_t cameraNum)
+{
+    uint32_t columns = 1;
+    while (columns * columns < cameraNum) {
+        columns++;
+    }
+    uint32_t rows = (cameraNum + columns - 1) / columns;
+
+    std::vector<Tile> tiles;
+    for (uint32_t i = 0; i < cameraNum; i++) {
+        tiles.push_back(Tile{static_cast<float>(i % columns) / columns,
+                             static_cast<float>(i / columns) / rows,
+                             1.0f / columns, 1.0f / rows, i});
+    }
+    return Layout(tiles);
+}
+
+Layout Layout::pictureInPicture(uint32_t cameraNum, uint32_t mainCamera)
+{
+    // four insets per row, rows stacked upwards from the bottom edge
+    static const uint32_t perRow = 4;
+    static const float size = 0.2f;
+    static const float margin = 0.04f;
+
+    std::vector<Tile> tiles;
+    tiles.push_back(Tile{0.0f, 0.0f, 1.0f, 1.0f, mainCamera});
+
+    uint32_t inset = 0;
+    for (uint32_t i = 0; i < cameraNum; i++) {
+        if (i == mainCamera) {
+            continue;
+        }
+        uint32_t column = inset % perRow;
+        uint32_t row = inset / perRow;
+        tiles.push_back(Tile{1.0f - (column + 1) * (size + margin),
+                             1.0f - (row + 1) * (size + margin),
+                             size, size, i});
+        inset++;
+    }
+    return Layout(tiles);
+}
+
+Layout Layout::parse(const std::string &spec)
+{
+    std::vector<Tile> tiles;
+    std::istringstream stream(spec);
+    std::string item;
+
+    while (std::getline(stream, item, ';')) {
+        Tile tile;
+        char end;
+        if (std::sscanf(item.c_str(), "%u:%f,%f,%f,%f%c", &tile.camera,
+                        &tile.x, &tile.y, &tile.width, &tile.height,
+                        &end) != 5 ||
+            tile.width < 0.0f || tile.height < 0.0f) {
+            throw std::runtime_error("invalid layout tile \"" + item + "\"");
+        }
+        tiles.push_back(tile);
+    }
+    return Layout(tiles);
+}
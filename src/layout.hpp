@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where the cameras go in the window. Tiles are drawn in order, a tile
+// covers the ones before it.
+class Layout
+{
+public:
+    struct Tile
+    {
+        // window fraction from the top left corner
+        float x;
+        float y;
+        float width;
+        float height;
+        uint32_t camera;
+    };
+
+    Layout() {}
+    explicit Layout(const std::vector<Tile> &tiles) :
+        m_tiles(tiles)
+    {}
+
+    // equal cells, filled row by row
+    static Layout grid(uint32_t cameraNum);
+    // mainCamera fills the window, the others are insets in the bottom
+    // right corner
+    static Layout pictureInPicture(uint32_t cameraNum, uint32_t mainCamera);
+    // "camera:x,y,width,height" tiles separated by ';', throws if malformed
+    static Layout parse(const std::string &spec);
+
+    const std::vector<Tile> &tiles() const
+    {
+        return m_tiles;
+    }
+
+private:
+    std::vector<Tile> m_tiles;
+};
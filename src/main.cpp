@@ -3,17 +3,398 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <memory>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
 
 #include <signal.h>
+#include <getopt.h>
 
 #include <opencv2/opencv.hpp>
 
 #include "render.hpp"
 #include "v4l2capture.hpp"
+#include "syntheticsource.hpp"
+#include "recordingsource.hpp"
+#include "replaysource.hpp"
+#include "capturethread.hpp"
+#include "eventloop.hpp"
+#include "colorconvert.hpp"
+
+using FrameSources = std::vector<std::unique_ptr<FrameSource>>;
 
 static volatile bool keepRunning = true;
+static bool printLatency = false;
+static EventLoop *eventLoop = nullptr;
+
+static void usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [options]" << std::endl
+              << "  -d, --dmabuf         sample the V4L2 mmap buffers directly"
+              << std::endl
+              << "  -s, --single-thread  epoll all cameras from the render "
+                 "thread" << std::endl
+              << "  -c, --cpu-convert    convert to RGBA on the CPU before "
+                 "upload" << std::endl
+              << "  -l, --latency        print per camera latency percentiles"
+              << std::endl
+              << "  -f, --format <fmt>   xbgr32 (default), yuyv, uyvy, nv12"
+              << std::endl
+              << "                       or nv12m"
+              << std::endl
+              << "  -D, --device <path>  add a V4L2 camera, /dev/video4 if "
+                 "none is given" << std::endl
+              << "  -S, --synthetic <p>  add synthetic cameras: bars, "
+                 "gradient, image" << std::endl
+              << "                       (src_1.jpg) or an image file"
+              << std::endl
+              << "  -n, --cameras <n>    number of synthetic cameras "
+                 "(default 1)" << std::endl
+              << "  -r, --fps <rate>     synthetic frame rate (default 30)"
+              << std::endl
+              << "  -b, --buffers <n>    capture buffers per camera "
+                 "(default 4)" << std::endl
+              << "  -o, --record <dir>   record every camera frame into dir"
+              << std::endl
+              << "  -P, --replay <dir>   play a recording back instead of "
+                 "cameras" << std::endl
+              << "  -F, --fast           replay as fast as frames are "
+                 "displayed" << std::endl
+              << "  -t, --seek <s>       start the replay s seconds in"
+              << std::endl
+              << "  -L, --layout <l>     grid (default), pip or tiles "
+                 "\"cam:x,y,w,h;...\"" << std::endl
+              << "                       keys: g grid, p picture in picture"
+              << std::endl
+              << "  -H, --headless       render offscreen, no window"
+              << std::endl
+              << "  -C, --clock <rate>   render at a fixed rate instead of "
+                 "on new frames" << std::endl
+              << "  -R, --readback <dir> record the rendered frames into dir"
+              << std::endl
+              << "  -G, --gpu-profile    print GPU time per stage, key t "
+                 "toggles it" << std::endl;
+}
+
+static bool parsePixFormat(const std::string &name,
+                           V4l2Capture::PixFormat &pixFmt)
+{
+    if (name == "xbgr32") {
+        pixFmt = V4l2Capture::PixFormat::XBGR32;
+    } else if (name == "yuyv") {
+        pixFmt = V4l2Capture::PixFormat::YUYV;
+    } else if (name == "uyvy") {
+        pixFmt = V4l2Capture::PixFormat::UYVY;
+    } else if (name == "nv12") {
+        pixFmt = V4l2Capture::PixFormat::NV12;
+    } else if (name == "nv12m") {
+        pixFmt = V4l2Capture::PixFormat::NV12M;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static SyntheticSource *newSyntheticSource(const std::string &pattern,
+                                           double fps)
+{
+    if (pattern == "bars") {
+        return new SyntheticSource(SyntheticSource::Pattern::Bars, fps);
+    } else if (pattern == "gradient") {
+        return new SyntheticSource(SyntheticSource::Pattern::Gradient, fps);
+    }
+
+    // installed next to the binary, like the shaders
+    return new SyntheticSource(SyntheticSource::Pattern::Image, fps,
+                               pattern == "image" ? "src_1.jpg" : pattern);
+}
+
+// render rate plus what each camera delivered, lost and skipped per second
+class RateCounter
+{
+public:
+    RateCounter(Render &render, FrameSources &captures) :
+        m_render(render),
+        m_captures(captures),
+        m_previousStats(captures.size())
+    {
+        for (size_t i = 0; i < captures.size(); i++) {
+            m_previousStats[i] = captures[i]->stats().snapshot();
+        }
+    }
+
+    void frameRendered()
+    {
+        double currentTime = monotonicNs() / 1e9;
+        m_frameCount++;
+        double deltaT = currentTime - m_previousTime;
+        if (deltaT >= 1.0) {
+            std::cout << m_frameCount / deltaT << " fps";
+            for (size_t i = 0; i < m_captures.size(); i++) {
+                StreamStats::Snapshot stats =
+                    m_captures[i]->stats().snapshot();
+                StreamStats::Snapshot &previous = m_previousStats[i];
+
+                std::cout << " | camera " << i << ": "
+                          << (stats.displayed - previous.displayed) / deltaT
+                          << " fps, "
+                          << stats.dropped - previous.dropped << " dropped, "
+                          << stats.superseded - previous.superseded
+                          << " superseded";
+                previous = stats;
+            }
+            std::cout << std::endl;
+            m_frameCount = 0;
+            m_previousTime = currentTime;
+        }
+
+        // percentiles over the last window only
+        if ((printLatency || m_render.gpuProfiling()) &&
+            currentTime - m_latencyTime >= 5.0) {
+            if (printLatency) {
+                m_render.latencyStats().print(std::cout);
+                m_render.latencyStats().reset();
+            }
+            m_render.gpuStats().print(std::cout);
+            m_render.gpuStats().reset();
+            m_latencyTime = currentTime;
+        }
+    }
+
+private:
+    Render &m_render;
+    FrameSources &m_captures;
+    std::vector<StreamStats::Snapshot> m_previousStats;
+    int m_frameCount = 0;
+    double m_previousTime = monotonicNs() / 1e9;
+    double m_latencyTime = m_previousTime;
+};
+
+// --cpu-convert: cameras capture into host buffers which are converted to
+// RGBA straight into the render staging slots
+class CpuConverter
+{
+public:
+    CpuConverter(uint32_t pixelFormat, uint32_t width, uint32_t height) :
+        m_pixelFormat(pixelFormat),
+        m_width(width),
+        m_height(height)
+    {
+        std::cout << "cpu color conversion: "
+                  << ColorConvert::isaName(m_convert.isa()) << std::endl;
+    }
+
+    ~CpuConverter()
+    {
+        for (auto &camera : m_captureBufs) {
+            for (void *buf : camera) {
+                free(buf);
+            }
+        }
+    }
+
+    CpuConverter(const CpuConverter &) = delete;
+    CpuConverter &operator=(const CpuConverter &) = delete;
+
+    // allocates the capture buffers of the next camera
+    std::vector<V4l2Capture::Buffer> addCamera(
+            const std::vector<void *> &renderBufs, size_t length)
+    {
+        std::vector<V4l2Capture::Buffer> buffers(renderBufs.size());
+
+        m_captureBufs.push_back(std::vector<void *>(renderBufs.size()));
+        m_renderBufs.push_back(renderBufs);
+        // userptr wants page aligned buffers
+        length = (length + 4095) & ~static_cast<size_t>(4095);
+        for (size_t i = 0; i < buffers.size(); i++) {
+            void *buf = aligned_alloc(4096, length);
+            if (!buf) {
+                throw std::runtime_error("failed to allocate capture buffer");
+            }
+            m_captureBufs.back()[i] = buf;
+            buffers[i] = V4l2Capture::Buffer(buf, length);
+        }
+        return buffers;
+    }
+
+    void convert(int index, int subIndex, uint32_t bytesPerLine)
+    {
+        m_convert.toRgba(m_pixelFormat,
+                         static_cast<const uint8_t *>(
+                             m_captureBufs.at(index).at(subIndex)),
+                         bytesPerLine,
+                         static_cast<uint8_t *>(
+                             m_renderBufs.at(index).at(subIndex)),
+                         m_width, m_height);
+    }
+
+private:
+    ColorConvert m_convert;
+    uint32_t m_pixelFormat;
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<std::vector<void *>> m_captureBufs;
+    std::vector<std::vector<void *>> m_renderBufs;
+};
+
+// Decides when the loops render: as soon as a camera delivered a frame or,
+// with --clock, on a fixed tick with whatever arrived since the last one.
+class FramePacer
+{
+public:
+    explicit FramePacer(double rate) :
+        m_period(rate > 0 ? static_cast<uint64_t>(1e9 / rate) : 0),
+        m_next(monotonicNs() + m_period)
+    {}
+
+    // how long to sleep waiting for frames, at most maxMs
+    int timeoutMs(int maxMs) const
+    {
+        if (!m_period) {
+            return maxMs;
+        }
+        uint64_t now = monotonicNs();
+        if (now >= m_next) {
+            return 0;
+        }
+        return std::min<uint64_t>(maxMs, (m_next - now + 999999) / 1000000);
+    }
+
+    bool shouldRender(int newFrames)
+    {
+        if (!m_period) {
+            return newFrames > 0;
+        }
+        uint64_t now = monotonicNs();
+        if (now < m_next) {
+            return false;
+        }
+        // ticks missed while rendering are skipped, not caught up on
+        m_next += m_period;
+        if (m_next <= now) {
+            m_next = now + m_period;
+        }
+        return true;
+    }
+
+private:
+    uint64_t m_period;
+    uint64_t m_next;
+};
+
+static void runThreaded(Render &render, FrameSources &captures,
+                        CpuConverter *converter, FramePacer &pacer)
+{
+    // headless there is no GLFW to post empty events to
+    EventLoop waiter;
+    std::function<void()> notify = glfwPostEmptyEvent;
+    if (render.headless()) {
+        notify = [&waiter]() { waiter.wakeup(); };
+        eventLoop = &waiter;
+    }
+
+    std::vector<std::unique_ptr<CaptureThread>> threads;
+    for (size_t i = 0; i < captures.size(); i++) {
+        threads.emplace_back(new CaptureThread(*captures[i], notify));
+        threads.back()->start();
+    }
+
+    RateCounter rate(render, captures);
+    while (keepRunning) {
+        // the capture threads wake us when they queued a frame
+        int timeout = pacer.timeoutMs(100);
+        if (render.headless()) {
+            waiter.runOnce(timeout);
+        } else if (timeout > 0) {
+            glfwWaitEventsTimeout(timeout / 1000.0);
+        } else {
+            glfwPollEvents();
+        }
+
+        int fCount = 0;
+        for (size_t i = 0; i < threads.size(); i++) {
+            Frame frame;
+
+            if (!threads[i]->takeLatest(frame)) {
+                continue;
+            }
+
+            fCount++;
+
+            if (converter) {
+                converter->convert(i, frame.index,
+                                   captures[i]->bytesPerLine());
+            }
+            render.updateTexture(i, frame);
+        }
+
+        if (!pacer.shouldRender(fCount)) {
+            continue;
+        }
+        render.render(0);
+        rate.frameRendered();
+    }
+
+    // the capture threads are joined before the waiter goes away
+    threads.clear();
+    eventLoop = nullptr;
+}
+
+static void runReactor(Render &render, FrameSources &captures,
+                       CpuConverter *converter, FramePacer &pacer)
+{
+    EventLoop loop;
+    std::vector<Frame> latest(captures.size());
+
+    for (size_t i = 0; i < captures.size(); i++) {
+        loop.add(captures[i]->fd(), [&captures, &latest, i]() {
+            Frame frame;
+            while ((frame = captures[i]->readFrame()).index != -1) {
+                if (latest[i].index != -1) {
+                    StreamStats::add(captures[i]->stats().superseded);
+                    captures[i]->doneFrame(latest[i].index);
+                }
+                latest[i] = frame;
+            }
+        });
+    }
+
+    eventLoop = &loop;
+
+    RateCounter rate(render, captures);
+    while (keepRunning) {
+        // window events are only polled, bound the sleep for them
+        loop.runOnce(pacer.timeoutMs(100));
+        render.pollEvents();
+
+        int fCount = 0;
+        for (size_t i = 0; i < latest.size(); i++) {
+            if (latest[i].index == -1) {
+                continue;
+            }
+
+            fCount++;
+
+            if (converter) {
+                converter->convert(i, latest[i].index,
+                                   captures[i]->bytesPerLine());
+            }
+            render.updateTexture(i, latest[i]);
+            latest[i] = Frame();
+        }
 
-int main()
+        if (!pacer.shouldRender(fCount)) {
+            continue;
+        }
+        render.render(0);
+        rate.frameRendered();
+    }
+
+    eventLoop = nullptr;
+}
+
+int main(int argc, char *argv[])
 {
     // V4l2Capture captures;
     // std::vector<V4l2Capture::Buffer> buffers(4);
@@ -26,67 +407,358 @@ int main()
     // }
     // return 0;
 
-    int cameraNum = 4;
+    static const struct option longOptions[] = {
+        {"dmabuf", no_argument, nullptr, 'd'},
+        {"single-thread", no_argument, nullptr, 's'},
+        {"format", required_argument, nullptr, 'f'},
+        {"cpu-convert", no_argument, nullptr, 'c'},
+        {"latency", no_argument, nullptr, 'l'},
+        {"device", required_argument, nullptr, 'D'},
+        {"synthetic", required_argument, nullptr, 'S'},
+        {"cameras", required_argument, nullptr, 'n'},
+        {"fps", required_argument, nullptr, 'r'},
+        {"buffers", required_argument, nullptr, 'b'},
+        {"record", required_argument, nullptr, 'o'},
+        {"replay", required_argument, nullptr, 'P'},
+        {"fast", no_argument, nullptr, 'F'},
+        {"seek", required_argument, nullptr, 't'},
+        {"layout", required_argument, nullptr, 'L'},
+        {"headless", no_argument, nullptr, 'H'},
+        {"clock", required_argument, nullptr, 'C'},
+        {"readback", required_argument, nullptr, 'R'},
+        {"gpu-profile", no_argument, nullptr, 'G'},
+        {nullptr, 0, nullptr, 0}
+    };
+    bool dmaBuf = false;
+    bool singleThread = false;
+    bool cpuConvert = false;
+    V4l2Capture::PixFormat pixFmt = V4l2Capture::PixFormat::XBGR32;
+    std::vector<std::string> devices;
+    std::string synthetic;
+    int syntheticNum = 1;
+    double syntheticFps = 30.0;
+    int bufferNum = 4;
+    std::string recordDir;
+    std::string replayDir;
+    auto replayTiming = ReplaySource::Timing::Recorded;
+    double replaySeek = 0.0;
+    std::string layout = "grid";
+    bool headless = false;
+    double clockRate = 0.0;
+    std::string readbackDir;
+    bool gpuProfile = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "dsf:clD:S:n:r:b:o:P:Ft:L:HC:R:G", longOptions,
+                              nullptr)) != -1) {
+        switch (opt) {
+        case 'd':
+            dmaBuf = true;
+            break;
+        case 's':
+            singleThread = true;
+            break;
+        case 'c':
+            cpuConvert = true;
+            break;
+        case 'l':
+            printLatency = true;
+            break;
+        case 'D':
+            devices.push_back(optarg);
+            break;
+        case 'S':
+            synthetic = optarg;
+            break;
+        case 'n':
+            syntheticNum = std::atoi(optarg);
+            break;
+        case 'r':
+            syntheticFps = std::atof(optarg);
+            break;
+        case 'b':
+            bufferNum = std::atoi(optarg);
+            break;
+        case 'o':
+            recordDir = optarg;
+            break;
+        case 'P':
+            replayDir = optarg;
+            break;
+        case 'F':
+            replayTiming = ReplaySource::Timing::Fast;
+            break;
+        case 't':
+            replaySeek = std::atof(optarg);
+            break;
+        case 'L':
+            layout = optarg;
+            break;
+        case 'H':
+            headless = true;
+            break;
+        case 'C':
+            clockRate = std::atof(optarg);
+            break;
+        case 'R':
+            readbackDir = optarg;
+            break;
+        case 'G':
+            gpuProfile = true;
+            break;
+        case 'f':
+            if (!parsePixFormat(optarg, pixFmt)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (dmaBuf && cpuConvert) {
+        std::cerr << "--cpu-convert needs the staging path, not --dmabuf"
+                  << std::endl;
+        return -1;
+    }
+    if (!replayDir.empty() &&
+        (dmaBuf || !devices.empty() || !synthetic.empty())) {
+        std::cerr << "--replay replaces the cameras and needs the staging "
+                     "path" << std::endl;
+        return -1;
+    }
+    if (devices.empty() && synthetic.empty() && replayDir.empty()) {
+        devices.push_back("/dev/video4");
+    }
+    if (dmaBuf && !recordDir.empty()) {
+        std::cerr << "--record needs the staging path, not --dmabuf"
+                  << std::endl;
+        return -1;
+    }
+    if (synthetic.empty()) {
+        syntheticNum = 0;
+    } else if (dmaBuf) {
+        std::cerr << "synthetic cameras can not be imported with --dmabuf"
+                  << std::endl;
+        return -1;
+    }
+    if (syntheticNum < 0 ||
+        devices.size() + syntheticNum > Render::MAX_CAMERAS) {
+        std::cerr << "at most " << Render::MAX_CAMERAS
+                  << " cameras are supported" << std::endl;
+        return -1;
+    }
+    if (bufferNum < 2 ||
+        bufferNum > static_cast<int>(FrameSource::MAX_BUFFERS)) {
+        std::cerr << "--buffers must be 2 to " << FrameSource::MAX_BUFFERS
+                  << std::endl;
+        return -1;
+    }
+
     Render render;
-    signal(SIGINT, [](int){ keepRunning = false; });
-    std::vector<V4l2Capture> captures(1);
-    std::vector<std::array<V4l2Capture::Buffer, 4>> buffers(4);
-    std::vector<std::array<void *, 4>> renderBufs(4);
+    // hands the readback slots back to render, so it goes first
+    std::unique_ptr<Recorder> readbackRecorder;
+    signal(SIGINT, [](int) {
+        keepRunning = false;
+        if (eventLoop) {
+            eventLoop->wakeup();
+        }
+    });
+    // outlives the captures streaming into its buffers
+    std::unique_ptr<CpuConverter> converter;
+    FrameSources captures;
+    // drained before the captures it hands buffers back to are destroyed
+    std::unique_ptr<Recorder> recorder;
+    std::vector<std::vector<V4l2Capture::Buffer>> buffers;
+    std::vector<std::vector<void *>> renderBufs;
 
     try {
-        render.init();
-        for (size_t i = 0; i < captures.size(); i++) {
-            render.getBufferAddrs(i, renderBufs[i]);
-            for (size_t j = 0; j < renderBufs[i].size(); j++) {
-                buffers[i][j].start = renderBufs[i][j];
-                buffers[i][j].length = 1280 * 800 * 4;
+        Render::Config config;
+        config.dmaBuf = dmaBuf;
+        config.bufferNum = bufferNum;
+        config.headless = headless;
+        if (!readbackDir.empty()) {
+            // one being written, one waiting, one being rendered into
+            config.readbackDepth = 3;
+            Recorder::Config recordConfig;
+            recordConfig.directory = readbackDir;
+            recordConfig.queueDepth = config.readbackDepth;
+            readbackRecorder.reset(new Recorder(recordConfig));
+        }
+        std::vector<std::string> paths;
+        if (!replayDir.empty()) {
+            for (uint32_t camera : ReplaySource::cameras(replayDir)) {
+                std::unique_ptr<ReplaySource> replay(
+                    new ReplaySource(replayDir, camera, replayTiming));
+                replay->seek(static_cast<uint64_t>(replaySeek * 1e9));
+                // one format for all cameras, the first one decides
+                V4l2Capture::ImgFormat recorded = replay->imgFormat();
+                if (captures.empty()) {
+                    config.imageWidth = recorded.width;
+                    config.imageHeight = recorded.height;
+                    pixFmt = recorded.m_pixFmt;
+                }
+                captures.push_back(std::move(replay));
+                paths.push_back("replay" + std::to_string(camera));
+            }
+            if (captures.size() > Render::MAX_CAMERAS) {
+                throw std::runtime_error("too many cameras in the recording");
             }
-            captures[i].open("/dev/video4",
-                             V4l2Capture::ImgFormat(
-                                 1280, 800, V4l2Capture::PixFormat::XBGR32),
-                             buffers[i]);
-            captures[i].start();
         }
+        // with --cpu-convert the GPU only ever sees RGBA
+        config.pixelFormat = cpuConvert ? V4L2_PIX_FMT_XBGR32 :
+                                          static_cast<uint32_t>(pixFmt);
+        V4l2Capture::ImgFormat imgFormat(config.imageWidth, config.imageHeight,
+                                         pixFmt);
 
-        int frameCount = 0;
-        double previousTime = glfwGetTime();
-        double currentTime;
-        int fCount = 0;
-
-        int index[4] = {0, 0, 0, 0};
+        if (dmaBuf) {
+            for (const std::string &device : devices) {
+                std::unique_ptr<V4l2Capture> capture(new V4l2Capture());
+                capture->open(device, imgFormat, bufferNum);
 
-        while (keepRunning) {
-            glfwPollEvents();
+                Render::DmaBufImport import;
+                import.fds = capture->exportBuffers();
+                import.bytesPerLine = capture->bytesPerLine();
+                config.dmaBufs.push_back(import);
+                captures.push_back(std::move(capture));
+            }
+            render.init(config);
+        } else {
+            for (const std::string &device : devices) {
+                captures.emplace_back(new V4l2Capture());
+                paths.push_back(device);
+            }
+            for (int i = 0; i < syntheticNum; i++) {
+                captures.emplace_back(newSyntheticSource(synthetic,
+                                                         syntheticFps));
+                paths.push_back("synthetic" + std::to_string(i));
+            }
+            if (!recordDir.empty()) {
+                Recorder::Config recordConfig;
+                recordConfig.directory = recordDir;
+                recorder.reset(new Recorder(recordConfig));
+                for (size_t i = 0; i < captures.size(); i++) {
+                    captures[i].reset(new RecordingSource(
+                        std::move(captures[i]), *recorder, i));
+                }
+            }
 
+            config.cameraNum = captures.size();
+            render.init(config);
+            if (cpuConvert) {
+                converter.reset(new CpuConverter(
+                    static_cast<uint32_t>(pixFmt),
+                    config.imageWidth, config.imageHeight));
+            }
+            buffers.resize(captures.size());
+            renderBufs.resize(captures.size());
             for (size_t i = 0; i < captures.size(); i++) {
-
-                index[i] = captures[i].readFrame();
-
-                if (index[i] == -1) {
-                    // std::cout << "errno : " << errno << std::endl;
-                    continue;
+                render.getBufferAddrs(i, renderBufs[i]);
+                if (converter) {
+                    // RGBA slots are large enough for any capture format
+                    buffers[i] = converter->addCamera(renderBufs[i],
+                                                      render.frameSize());
+                } else {
+                    for (void *renderBuf : renderBufs[i]) {
+                        buffers[i].push_back(V4l2Capture::Buffer(
+                            renderBuf, render.frameSize()));
+                    }
                 }
+                captures[i]->open(paths[i], imgFormat, buffers[i]);
+                if (captures[i]->frameSize() >
+                        static_cast<int>(render.frameSize())) {
+                    throw std::runtime_error("capture frame does not fit");
+                }
+            }
+        }
 
-                fCount++;
+        render.setReleaseCallback([&captures](int index, int subIndex) {
+            captures.at(index)->doneFrame(subIndex);
+        });
+        std::vector<StreamStats *> streamStats;
+        for (auto &capture : captures) {
+            streamStats.push_back(&capture->stats());
+        }
+        render.setStreamStats(streamStats);
 
-                render.updateTexture(i, index[i]);
-                captures[i].doneFrame(index[i]);
+        uint32_t cameraNum = captures.size();
+        if (layout == "pip") {
+            render.setLayout(Layout::pictureInPicture(cameraNum, 0));
+        } else if (layout != "grid") {
+            render.setLayout(Layout::parse(layout));
+        }
+        if (gpuProfile) {
+            render.setGpuProfiling(true);
+            if (!render.gpuProfiling()) {
+                std::cout << "no timestamps on the graphics queue"
+                          << std::endl;
+            }
+        }
+        // p again puts the next camera in front
+        uint32_t pipCamera = 0;
+        render.setKeyCallback([&render, cameraNum, &pipCamera](int key) {
+            if (key == GLFW_KEY_G) {
+                render.setLayout(Layout::grid(cameraNum));
+            } else if (key == GLFW_KEY_P) {
+                render.setLayout(Layout::pictureInPicture(cameraNum,
+                                                          pipCamera));
+                pipCamera = (pipCamera + 1) % cameraNum;
+            } else if (key == GLFW_KEY_T) {
+                render.setGpuProfiling(!render.gpuProfiling());
+                std::cout << "gpu profiling "
+                          << (render.gpuProfiling() ? "on" : "off")
+                          << std::endl;
             }
-            render.render(0);
+        });
+        if (readbackRecorder) {
+            Recorder *out = readbackRecorder.get();
+            uint32_t sequence = 0;
+            render.setReadbackCallback(
+                    [&render, out, sequence](
+                        const Render::ReadbackFrame &frame) mutable {
+                RecordHeader header;
+                header.sequence = sequence++;
+                header.pixelFormat =
+                    frame.format == vk::Format::eR8G8B8A8Unorm ?
+                    v4l2_fourcc('A', 'B', '2', '4') : V4L2_PIX_FMT_XBGR32;
+                header.width = frame.width;
+                header.height = frame.height;
+                header.bytesPerLine = frame.bytesPerLine;
+                header.payloadSize = frame.bytesPerLine * frame.height;
+                header.bytesUsed = header.payloadSize;
+                header.captureTime = monotonicNs();
+                header.dequeueTime = header.captureTime;
 
-            if (fCount != 0) {
-                currentTime = glfwGetTime();
-                frameCount++;
-                double deltaT = currentTime - previousTime;
-                if (deltaT >= 1.0) {
-                    std::cout << frameCount / deltaT << std::endl;
-                    frameCount = 0;
-                    previousTime = currentTime;
+                int slot = frame.slot;
+                if (!out->submit(header, frame.data, [&render, slot]() {
+                        render.releaseReadback(slot);
+                    })) {
+                    render.releaseReadback(slot);
                 }
-                fCount = 0;
-            }
-            // std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            });
+            readbackRecorder->start();
+        }
+        if (recorder) {
+            recorder->start();
+        }
+        for (size_t i = 0; i < captures.size(); i++) {
+            captures[i]->start();
+        }
+
+        FramePacer pacer(clockRate);
+        if (singleThread) {
+            runReactor(render, captures, converter.get(), pacer);
+        } else {
+            runThreaded(render, captures, converter.get(), pacer);
+        }
+        // while the captures still stream, they take the buffers back
+        if (recorder) {
+            recorder->stop();
+        }
+        if (readbackRecorder) {
+            readbackRecorder->stop();
         }
+        render.memoryAllocator().print(std::cout);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return -1;
@@ -0,0 +1,256 @@
+#include "memoryallocator.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <stdexcept>
+
+static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static vk::DeviceSize alignDown(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return value / alignment * alignment;
+}
+
+MemoryAllocator::Allocation::Allocation(Allocation &&other)
+{
+    *this = std::move(other);
+}
+
+MemoryAllocator::Allocation &
+MemoryAllocator::Allocation::operator=(Allocation &&other)
+{
+    if (this != &other) {
+        reset();
+        m_allocator = other.m_allocator;
+        m_block = other.m_block;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        other.m_allocator = nullptr;
+        other.m_block = nullptr;
+    }
+    return *this;
+}
+
+void MemoryAllocator::Allocation::reset()
+{
+    if (m_block) {
+        m_allocator->free(m_block, m_offset, m_size);
+        m_allocator = nullptr;
+        m_block = nullptr;
+    }
+}
+
+vk::DeviceMemory MemoryAllocator::Allocation::memory() const
+{
+    return m_block ? *m_block->memory : vk::DeviceMemory();
+}
+
+void *MemoryAllocator::Allocation::map() const
+{
+    if (!m_block || !m_block->mapped) {
+        throw std::runtime_error("memory is not host visible");
+    }
+    return m_block->mapped + m_offset;
+}
+
+MemoryAllocator::MemoryAllocator(vk::PhysicalDevice physicalDevice,
+                                 vk::Device device, vk::DeviceSize blockSize) :
+    m_device(device),
+    m_memoryProperties(physicalDevice.getMemoryProperties()),
+    m_blockSize(blockSize)
+{
+    vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+    // buffers and optimal images may share a block, keeping every range
+    // granularity aligned means they never share a page
+    m_granularity = limits.bufferImageGranularity;
+    m_atomSize = limits.nonCoherentAtomSize;
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    for (const auto &block : m_blocks) {
+        if (block->mapped) {
+            m_device.unmapMemory(*block->memory);
+        }
+    }
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::allocate(const vk::MemoryRequirements &requirements,
+                          uint32_t memoryTypeIndex)
+{
+    vk::MemoryPropertyFlags flags =
+        m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    vk::DeviceSize alignment = std::max(requirements.alignment,
+                                        m_granularity);
+    // so invalidate() never touches a neighbour's atoms
+    if ((flags & vk::MemoryPropertyFlagBits::eHostVisible) &&
+        !(flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+        alignment = std::max(alignment, m_atomSize);
+    }
+    vk::DeviceSize size = alignUp(requirements.size, alignment);
+
+    Allocation allocation;
+    if (size <= m_blockSize) {
+        for (const auto &block : m_blocks) {
+            if (block->memoryType == memoryTypeIndex && !block->dedicated &&
+                allocateFrom(*block, size, alignment, allocation)) {
+                return allocation;
+            }
+        }
+    }
+
+    Block *block = createBlock(memoryTypeIndex, std::max(size, m_blockSize),
+                               size > m_blockSize);
+    if (!allocateFrom(*block, size, alignment, allocation)) {
+        throw std::runtime_error("memory block too small");
+    }
+    return allocation;
+}
+
+void MemoryAllocator::invalidate(const Allocation &allocation,
+                                 vk::DeviceSize offset, vk::DeviceSize size)
+{
+    const Block *block = allocation.m_block;
+    vk::MemoryPropertyFlags flags =
+        m_memoryProperties.memoryTypes[block->memoryType].propertyFlags;
+    if (flags & vk::MemoryPropertyFlagBits::eHostCoherent) {
+        return;
+    }
+
+    // the allocation is atom aligned, rounding stays inside it or the block
+    vk::DeviceSize begin = alignDown(allocation.offset() + offset, m_atomSize);
+    vk::DeviceSize end = std::min(alignUp(allocation.offset() + offset + size,
+                                          m_atomSize),
+                                  block->size);
+    m_device.invalidateMappedMemoryRanges(
+            vk::MappedMemoryRange(*block->memory, begin, end - begin));
+}
+
+MemoryAllocator::Stats MemoryAllocator::stats() const
+{
+    Stats stats;
+    stats.blocks = m_blocks.size();
+    stats.allocations = m_allocations;
+    stats.used = m_used;
+    stats.peakUsed = m_peakUsed;
+    for (const auto &block : m_blocks) {
+        stats.reserved += block->size;
+        for (const auto &range : block->freeRanges) {
+            stats.largestFree = std::max(stats.largestFree, range.second);
+        }
+    }
+    return stats;
+}
+
+void MemoryAllocator::print(std::ostream &out) const
+{
+    Stats s = stats();
+    const double mib = 1024.0 * 1024.0;
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(1)
+        << "device memory: " << s.blocks << " blocks, " << s.reserved / mib
+        << " MiB reserved, " << s.used / mib << " MiB used by "
+        << s.allocations << " allocations (peak " << s.peakUsed / mib
+        << " MiB), " << s.fragmentation() * 100.0 << "% of free fragmented"
+        << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+MemoryAllocator::Block *MemoryAllocator::createBlock(uint32_t memoryType,
+                                                     vk::DeviceSize size,
+                                                     bool dedicated)
+{
+    std::unique_ptr<Block> block(new Block());
+    block->memory = m_device.allocateMemoryUnique(
+            vk::MemoryAllocateInfo(size, memoryType));
+    block->memoryType = memoryType;
+    block->size = size;
+    block->dedicated = dedicated;
+    block->freeRanges[0] = size;
+
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags &
+            vk::MemoryPropertyFlagBits::eHostVisible) {
+        block->mapped = static_cast<char *>(
+            m_device.mapMemory(*block->memory, 0, VK_WHOLE_SIZE));
+    }
+
+    m_blocks.push_back(std::move(block));
+    return m_blocks.back().get();
+}
+
+bool MemoryAllocator::allocateFrom(Block &block, vk::DeviceSize size,
+                                   vk::DeviceSize alignment,
+                                   Allocation &allocation)
+{
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end();
+         ++it) {
+        vk::DeviceSize rangeOffset = it->first;
+        vk::DeviceSize rangeEnd = it->first + it->second;
+        vk::DeviceSize offset = alignUp(rangeOffset, alignment);
+        if (offset + size > rangeEnd) {
+            continue;
+        }
+
+        // the alignment gap in front stays free
+        block.freeRanges.erase(it);
+        if (offset > rangeOffset) {
+            block.freeRanges[rangeOffset] = offset - rangeOffset;
+        }
+        if (offset + size < rangeEnd) {
+            block.freeRanges[offset + size] = rangeEnd - offset - size;
+        }
+
+        block.used += size;
+        m_used += size;
+        m_peakUsed = std::max(m_peakUsed, m_used);
+        m_allocations++;
+
+        allocation.m_allocator = this;
+        allocation.m_block = &block;
+        allocation.m_offset = offset;
+        allocation.m_size = size;
+        return true;
+    }
+    return false;
+}
+
+void MemoryAllocator::free(Block *block, vk::DeviceSize offset,
+                           vk::DeviceSize size)
+{
+    block->used -= size;
+    m_used -= size;
+    m_allocations--;
+
+    auto it = block->freeRanges.emplace(offset, size).first;
+    auto next = std::next(it);
+    if (next != block->freeRanges.end() && offset + size == next->first) {
+        it->second += next->second;
+        block->freeRanges.erase(next);
+    }
+    if (it != block->freeRanges.begin()) {
+        auto previous = std::prev(it);
+        if (previous->first + previous->second == it->first) {
+            previous->second += it->second;
+            block->freeRanges.erase(it);
+        }
+    }
+
+    if (block->dedicated && block->used == 0) {
+        auto owner = std::find_if(m_blocks.begin(), m_blocks.end(),
+                                  [block](const std::unique_ptr<Block> &b) {
+            return b.get() == block;
+        });
+        if (block->mapped) {
+            m_device.unmapMemory(*block->memory);
+        }
+        m_blocks.erase(owner);
+    }
+}
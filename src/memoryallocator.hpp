@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// Hands out aligned ranges of a few large VkDeviceMemory blocks per memory
+// type instead of one vkAllocateMemory per resource, which would soon hit
+// maxMemoryAllocationCount with many cameras. Each block keeps a first-fit
+// free list of offset ranges, merged again on free. Requests larger than the
+// block size get a block of their own, released once empty. Host-visible
+// blocks are mapped for their lifetime. Only used from the render thread.
+class MemoryAllocator
+{
+    struct Block;
+
+public:
+    struct Stats
+    {
+        // live vkAllocateMemory allocations
+        uint32_t blocks = 0;
+        uint64_t allocations = 0;
+        vk::DeviceSize reserved = 0;
+        vk::DeviceSize used = 0;
+        vk::DeviceSize peakUsed = 0;
+        vk::DeviceSize largestFree = 0;
+
+        // share of the free space outside the largest free range
+        double fragmentation() const
+        {
+            vk::DeviceSize free = reserved - used;
+            return free ? 1.0 - static_cast<double>(largestFree) / free : 0.0;
+        }
+    };
+
+    // a range of a block, returned to it when destroyed or reset
+    class Allocation
+    {
+    public:
+        Allocation() {}
+        Allocation(Allocation &&other);
+        Allocation &operator=(Allocation &&other);
+        ~Allocation()
+        {
+            reset();
+        }
+
+        Allocation(const Allocation &) = delete;
+        Allocation &operator=(const Allocation &) = delete;
+
+        void reset();
+
+        explicit operator bool() const
+        {
+            return m_block != nullptr;
+        }
+        vk::DeviceMemory memory() const;
+        vk::DeviceSize offset() const
+        {
+            return m_offset;
+        }
+        vk::DeviceSize size() const
+        {
+            return m_size;
+        }
+        // host address of offset(), throws if the memory is not host visible
+        void *map() const;
+
+    private:
+        friend class MemoryAllocator;
+
+        MemoryAllocator *m_allocator = nullptr;
+        Block *m_block = nullptr;
+        vk::DeviceSize m_offset = 0;
+        vk::DeviceSize m_size = 0;
+    };
+
+    MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device,
+                    vk::DeviceSize blockSize = 64ull << 20);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator &) = delete;
+    MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+
+    // memoryTypeIndex as found by Render::findMemoryType()
+    Allocation allocate(const vk::MemoryRequirements &requirements,
+                        uint32_t memoryTypeIndex);
+    // makes device writes to [offset, offset + size) of the allocation
+    // visible to the host, a no-op for coherent memory
+    void invalidate(const Allocation &allocation, vk::DeviceSize offset,
+                    vk::DeviceSize size);
+
+    Stats stats() const;
+    void print(std::ostream &out) const;
+
+private:
+    struct Block
+    {
+        vk::UniqueDeviceMemory memory;
+        uint32_t memoryType;
+        vk::DeviceSize size;
+        // a request above the block size, freed once empty
+        bool dedicated;
+        char *mapped = nullptr;
+        // offset -> size
+        std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+        vk::DeviceSize used = 0;
+    };
+
+    vk::Device m_device;
+    vk::PhysicalDeviceMemoryProperties m_memoryProperties;
+    vk::DeviceSize m_blockSize;
+    vk::DeviceSize m_granularity;
+    vk::DeviceSize m_atomSize;
+    std::vector<std::unique_ptr<Block>> m_blocks;
+    uint64_t m_allocations = 0;
+    vk::DeviceSize m_used = 0;
+    vk::DeviceSize m_peakUsed = 0;
+
+    Block *createBlock(uint32_t memoryType, vk::DeviceSize size,
+                       bool dedicated);
+    bool allocateFrom(Block &block, vk::DeviceSize size,
+                      vk::DeviceSize alignment, Allocation &allocation);
+    void free(Block *block, vk::DeviceSize offset, vk::DeviceSize size);
+};
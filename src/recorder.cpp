@@ -0,0 +1,252 @@
+#include "recorder.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "frame.hpp"
+
+Recorder::Recorder(const Config &config) :
+    m_config(config)
+{
+    if (m_config.queueDepth == 0 ||
+        m_config.segmentSize < 2 * RECORD_ALIGNMENT) {
+        throw std::runtime_error("invalid recorder config");
+    }
+
+    if (mkdir(m_config.directory.c_str(), 0755) && errno != EEXIST) {
+        throw std::runtime_error("failed to create " + m_config.directory);
+    }
+
+    m_headerBuf = aligned_alloc(RECORD_ALIGNMENT, RECORD_ALIGNMENT);
+    m_padBuf = aligned_alloc(RECORD_ALIGNMENT, RECORD_ALIGNMENT);
+    if (!m_headerBuf || !m_padBuf) {
+        free(m_headerBuf);
+        free(m_padBuf);
+        throw std::runtime_error("failed to allocate recorder buffers");
+    }
+    std::memset(m_padBuf, 0, RECORD_ALIGNMENT);
+}
+
+Recorder::~Recorder()
+{
+    stop();
+    free(m_headerBuf);
+    free(m_padBuf);
+}
+
+void Recorder::start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&Recorder::run, this);
+}
+
+void Recorder::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+
+    std::cout << "recorded " << m_written << " frames ("
+              << m_bytesWritten / (1024 * 1024) << " MiB, "
+              << m_directWrites << " O_DIRECT), " << m_dropped
+              << " not recorded" << std::endl;
+}
+
+bool Recorder::submit(const RecordHeader &header, const void *data,
+                      const std::function<void()> &done)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running || m_queue.size() >= m_config.queueDepth) {
+            m_dropped++;
+            return false;
+        }
+        m_queue.push_back(Request{header, data, done});
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+void Recorder::run()
+{
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() {
+                return !m_queue.empty() || !m_running;
+            });
+            // drain before leaving, the callers are waiting for their buffers
+            if (m_queue.empty()) {
+                break;
+            }
+            request = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        write(request);
+        if (request.done) {
+            request.done();
+        }
+    }
+
+    closeSegment();
+}
+
+void Recorder::write(const Request &request)
+{
+    RecordHeader header = request.header;
+    uint64_t payloadSize = header.payloadSize;
+    header.recordSize = RECORD_ALIGNMENT + recordAlign(payloadSize);
+
+    if (m_bufferedFd == -1 ||
+        (m_offset > RECORD_ALIGNMENT &&
+         m_offset + header.recordSize > m_config.segmentSize)) {
+        if (!openSegment()) {
+            m_dropped++;
+            return;
+        }
+    }
+
+    std::memset(m_headerBuf, 0, RECORD_ALIGNMENT);
+    std::memcpy(m_headerBuf, &header, sizeof(header));
+
+    struct iovec iov[3];
+    int count = 0;
+    iov[count].iov_base = m_headerBuf;
+    iov[count++].iov_len = RECORD_ALIGNMENT;
+    iov[count].iov_base = const_cast<void *>(request.data);
+    iov[count++].iov_len = payloadSize;
+    uint64_t padding = recordAlign(payloadSize) - payloadSize;
+    if (padding) {
+        iov[count].iov_base = m_padBuf;
+        iov[count++].iov_len = padding;
+    }
+
+    // O_DIRECT needs every segment aligned, the staging slots usually are
+    bool direct = m_directFd != -1 && padding == 0 &&
+        reinterpret_cast<uintptr_t>(request.data) % RECORD_ALIGNMENT == 0;
+    if (direct) {
+        // writeFully() advances the iovecs it was given
+        struct iovec directIov[3];
+        std::memcpy(directIov, iov, sizeof(iov));
+        if (!writeFully(m_directFd, directIov, count, m_offset)) {
+            std::cerr << "direct write failed, using buffered writes"
+                      << std::endl;
+            ::close(m_directFd);
+            m_directFd = -1;
+            m_directFailed = true;
+            direct = false;
+        }
+    }
+    if (!direct && !writeFully(m_bufferedFd, iov, count, m_offset)) {
+        m_dropped++;
+        return;
+    }
+
+    m_offset += header.recordSize;
+    m_bytesWritten += header.recordSize;
+    m_written++;
+    if (direct) {
+        m_directWrites++;
+    }
+}
+
+// runs on the writer thread, errors are reported rather than thrown
+bool Recorder::openSegment()
+{
+    if (m_bufferedFd != -1) {
+        closeSegment();
+        m_segmentIndex++;
+    }
+
+    std::string path = segmentPath(m_config.directory, m_segmentIndex);
+    m_bufferedFd = ::open(path.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_bufferedFd == -1) {
+        std::cerr << "failed to create " << path << ": "
+                  << std::strerror(errno) << std::endl;
+        return false;
+    }
+    // e.g. tmpfs refuses O_DIRECT, everything goes through the page cache
+    if (!m_directFailed) {
+        m_directFd = ::open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    }
+    if (m_directFd == -1 && m_segmentIndex == 0) {
+        std::cerr << path << ": no O_DIRECT, using buffered writes"
+                  << std::endl;
+    }
+
+    SegmentHeader header;
+    header.index = m_segmentIndex;
+    header.createTime = monotonicNs();
+    std::memset(m_headerBuf, 0, RECORD_ALIGNMENT);
+    std::memcpy(m_headerBuf, &header, sizeof(header));
+
+    struct iovec iov = {m_headerBuf, RECORD_ALIGNMENT};
+    if (!writeFully(m_directFd != -1 ? m_directFd : m_bufferedFd, &iov, 1, 0)) {
+        closeSegment();
+        return false;
+    }
+    m_offset = RECORD_ALIGNMENT;
+    return true;
+}
+
+void Recorder::closeSegment()
+{
+    if (m_directFd != -1) {
+        ::close(m_directFd);
+        m_directFd = -1;
+    }
+    if (m_bufferedFd != -1) {
+        ::close(m_bufferedFd);
+        m_bufferedFd = -1;
+    }
+}
+
+bool Recorder::writeFully(int fd, struct iovec *iov, int count,
+                          uint64_t offset)
+{
+    while (count > 0) {
+        ssize_t ret = pwritev(fd, iov, count, offset);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "recorder write failed: " << std::strerror(errno)
+                      << std::endl;
+            return false;
+        }
+
+        offset += ret;
+        size_t done = ret;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
+
+#include "recordformat.hpp"
+
+// Writes frames into segmented raw files (recordformat.hpp) on its own
+// thread. Frames are written straight from the capture buffers with
+// pwritev(), through O_DIRECT when the buffer and size are aligned.
+class Recorder
+{
+public:
+    struct Config
+    {
+        std::string directory;
+        // a new segment is started once this would be exceeded
+        uint64_t segmentSize = 1ull << 30;
+        // frames waiting for the writer, further frames are not recorded
+        size_t queueDepth = 8;
+    };
+
+    explicit Recorder(const Config &config);
+    virtual ~Recorder();
+
+    void start();
+    // writes what is queued and closes the segment
+    void stop();
+    // queues data for writing, done runs on the writer thread once the
+    // kernel no longer needs data. false (and done never runs) if the queue
+    // is full or the recorder is stopped.
+    bool submit(const RecordHeader &header, const void *data,
+                const std::function<void()> &done);
+
+private:
+    struct Request
+    {
+        RecordHeader header;
+        const void *data;
+        std::function<void()> done;
+    };
+
+    Config m_config;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Request> m_queue;
+    bool m_running = false;
+
+    // both on the current segment, O_DIRECT (if the filesystem allows)
+    // and buffered for unaligned frames
+    int m_directFd = -1;
+    int m_bufferedFd = -1;
+    // a direct write failed, e.g. on a staging slot mapping the kernel can
+    // not do direct I/O from, buffered writes only from then on
+    bool m_directFailed = false;
+    uint32_t m_segmentIndex = 0;
+    uint64_t m_offset = 0;
+    void *m_headerBuf = nullptr;
+    void *m_padBuf = nullptr;
+
+    std::atomic<uint64_t> m_written{0};
+    std::atomic<uint64_t> m_dropped{0};
+    uint64_t m_bytesWritten = 0;
+    uint64_t m_directWrites = 0;
+
+    void run();
+    void write(const Request &request);
+    bool openSegment();
+    void closeSegment();
+    bool writeFully(int fd, struct iovec *iov, int count, uint64_t offset);
+};
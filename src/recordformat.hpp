@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// On-disk layout of a recording, a directory of segment files
+// segment-000000.raw, segment-000001.raw, ... Each segment starts with a
+// SegmentHeader padded to RECORD_ALIGNMENT and is followed by records:
+// a RecordHeader padded to RECORD_ALIGNMENT, the raw frame as the camera
+// wrote it, zero padding up to RECORD_ALIGNMENT. All offsets and sizes are
+// aligned so the writer can use O_DIRECT. Little endian.
+
+constexpr uint32_t RECORD_ALIGNMENT = 4096;
+constexpr uint32_t RECORD_VERSION = 1;
+
+struct SegmentHeader
+{
+    // "VKCAPSEG"
+    static constexpr uint64_t MAGIC = 0x4745535041434b56ull;
+
+    uint64_t magic = MAGIC;
+    uint32_t version = RECORD_VERSION;
+    uint32_t alignment = RECORD_ALIGNMENT;
+    uint32_t index = 0;
+    uint32_t reserved = 0;
+    // CLOCK_MONOTONIC in ns, same clock as the frame timestamps
+    uint64_t createTime = 0;
+};
+
+struct RecordHeader
+{
+    // "VKFR"
+    static constexpr uint32_t MAGIC = 0x52464b56;
+
+    uint32_t magic = MAGIC;
+    uint32_t camera = 0;
+    uint32_t sequence = 0;
+    // V4L2 fourcc
+    uint32_t pixelFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bytesPerLine = 0;
+    // payload bytes following the header, bytesUsed of them were filled
+    uint32_t payloadSize = 0;
+    uint32_t bytesUsed = 0;
+    uint32_t reserved = 0;
+    // Frame::captureTime and Frame::dequeueTime
+    uint64_t captureTime = 0;
+    uint64_t dequeueTime = 0;
+    // header, payload and padding, the offset of the next record
+    uint64_t recordSize = 0;
+};
+
+static_assert(sizeof(SegmentHeader) <= RECORD_ALIGNMENT, "header too big");
+static_assert(sizeof(RecordHeader) <= RECORD_ALIGNMENT, "header too big");
+
+inline uint64_t recordAlign(uint64_t size)
+{
+    return (size + RECORD_ALIGNMENT - 1) & ~uint64_t(RECORD_ALIGNMENT - 1);
+}
+
+inline std::string segmentPath(const std::string &directory, uint32_t index)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%06u.raw", index);
+    return directory + "/" + name;
+}
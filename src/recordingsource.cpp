@@ -0,0 +1,61 @@
+#include "recordingsource.hpp"
+
+#include <utility>
+
+RecordingSource::RecordingSource(std::unique_ptr<FrameSource> source,
+                                 Recorder &recorder, uint32_t camera) :
+    m_source(std::move(source)),
+    m_recorder(recorder),
+    m_camera(camera)
+{
+}
+
+void RecordingSource::open(const std::string &path,
+                           const ImgFormat &imgFormat,
+                           const std::vector<Buffer> &buffers)
+{
+    m_source->open(path, imgFormat, buffers);
+    m_imgFormat = imgFormat;
+    m_buffers = buffers;
+    m_refs = std::vector<std::atomic<int>>(buffers.size());
+    for (auto &refs : m_refs) {
+        refs.store(0);
+    }
+}
+
+Frame RecordingSource::readFrame()
+{
+    Frame frame = m_source->readFrame();
+    if (frame.index == -1) {
+        return frame;
+    }
+
+    RecordHeader header;
+    header.camera = m_camera;
+    header.sequence = frame.sequence;
+    header.pixelFormat = static_cast<uint32_t>(m_imgFormat.m_pixFmt);
+    header.width = m_imgFormat.width;
+    header.height = m_imgFormat.height;
+    header.bytesPerLine = m_source->bytesPerLine();
+    header.payloadSize = m_source->frameSize();
+    header.bytesUsed = frame.bytesUsed;
+    header.captureTime = frame.captureTime;
+    header.dequeueTime = frame.dequeueTime;
+
+    // the writer may finish before submit() returns
+    int index = frame.index;
+    m_refs[index].store(2, std::memory_order_relaxed);
+    if (!m_recorder.submit(header, m_buffers[index].start,
+                           [this, index]() { doneFrame(index); })) {
+        m_refs[index].store(1, std::memory_order_relaxed);
+    }
+
+    return frame;
+}
+
+void RecordingSource::doneFrame(int index)
+{
+    if (m_refs.at(index).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        m_source->doneFrame(index);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "framesource.hpp"
+#include "recorder.hpp"
+
+// Tees the frames of another source into a Recorder. A buffer goes back to
+// the wrapped source once both the consumer and the writer are done with
+// it, the frame is never copied.
+class RecordingSource : public FrameSource
+{
+public:
+    RecordingSource(std::unique_ptr<FrameSource> source, Recorder &recorder,
+                    uint32_t camera);
+
+    void open(const std::string &path, const ImgFormat &imgFormat,
+              const std::vector<Buffer> &buffers) override;
+    int fd() const override
+    {
+        return m_source->fd();
+    }
+    uint32_t bytesPerLine() const override
+    {
+        return m_source->bytesPerLine();
+    }
+    int frameSize() const override
+    {
+        return m_source->frameSize();
+    }
+    void start() override
+    {
+        m_source->start();
+    }
+    void stop() override
+    {
+        m_source->stop();
+    }
+    Frame readFrame() override;
+    void doneFrame(int index) override;
+    StreamStats &stats() override
+    {
+        return m_source->stats();
+    }
+
+private:
+    std::unique_ptr<FrameSource> m_source;
+    Recorder &m_recorder;
+    uint32_t m_camera;
+    ImgFormat m_imgFormat;
+    std::vector<Buffer> m_buffers;
+    // consumer plus writer references per buffer
+    std::vector<std::atomic<int>> m_refs;
+};
@@ -8,45 +8,36 @@
 #include <limits>
 #include <fstream>
 #include <cstring>
-#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#include <unistd.h>
 
 #include <opencv2/opencv.hpp>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
+
+// SPIR-V generated by glslangValidator --vn, see src/CMakeLists.txt
+#include "shader.vert.h"
+#include "shader.frag.h"
+#include "dmabuf.frag.h"
 
 #define WIDTH 800
 #define HEIGHT 600
-static const int MAX_FRAMES_IN_FLIGHT = 2;
+const int Render::MAX_FRAMES_IN_FLIGHT;
+const uint32_t Render::TEXTURE_SLOTS;
 
+// a triangle strip, the texture is mirrored horizontally
 const std::vector<Render::Vertex> vertices = {
-    {{-1.0f, -1.0f}, {1.0f, 0.0f}},
-    {{0.0f, -1.0f}, {0.0f, 0.0f}},
-    {{-1.0f, 0.0f},  {1.0f, 1.0f}},
-    {{0.0f, 0.0f}, {0.0f, 1.0f}},
-
-    {{0.0f, -1.0f}, {1.0f, 0.0f}},
-    {{1.0f, -1.0f}, {0.0f, 0.0f}},
-    {{0.0f, 0.0f},  {1.0f, 1.0f}},
-    {{1.0f, 0.0f}, {0.0f, 1.0f}},
-
-    {{-1.0f, 0.0f}, {1.0f, 0.0f}},
-    {{0.0f, 0.0f}, {0.0f, 0.0f}},
-    {{-1.0f, 1.0f},  {1.0f, 1.0f}},
-    {{0.0f, 1.0f}, {0.0f, 1.0f}},
-
     {{0.0f, 0.0f}, {1.0f, 0.0f}},
     {{1.0f, 0.0f}, {0.0f, 0.0f}},
-    {{0.0f, 1.0f},  {1.0f, 1.0f}},
+    {{0.0f, 1.0f}, {1.0f, 1.0f}},
     {{1.0f, 1.0f}, {0.0f, 1.0f}}
 };
 
 const std::vector<uint16_t> indices = {
-    0, 1, 2, 3,
-    4, 5, 6, 7,
-    8, 9, 10, 11,
-    12, 13, 14, 15
+    0, 1, 2, 3
 };
 
 const std::vector<const char*> Render::validationLayers = {
@@ -57,6 +48,11 @@ const std::vector<const char*> Render::deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+const std::vector<const char*> Render::dmaBufDeviceExtensions = {
+    VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+    VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME
+};
+
 static PFN_vkDestroyDebugReportCallbackEXT pfn_vkDestroyDebugReportCallbackEXT;
 void vkDestroyDebugReportCallbackEXT(
         VkInstance                                  instance,
@@ -85,18 +81,62 @@ VkResult vkCreateDebugReportCallbackEXT(
             );
 }
 
+static PFN_vkGetMemoryFdPropertiesKHR pfn_vkGetMemoryFdPropertiesKHR;
+VkResult vkGetMemoryFdPropertiesKHR(
+        VkDevice                                    device,
+        VkExternalMemoryHandleTypeFlagBits          handleType,
+        int                                         fd,
+        VkMemoryFdPropertiesKHR*                    pMemoryFdProperties)
+{
+    return pfn_vkGetMemoryFdPropertiesKHR(
+            device,
+            handleType,
+            fd,
+            pMemoryFdProperties
+            );
+}
+
 Render::Render()
 {
 }
 
 Render::~Render()
 {
-    m_device->unmapMemory(*m_uStageMem);
+    // main() may fail before init()
+    if (!m_device) {
+        return;
+    }
+    m_device->waitIdle();
+    savePipelineCache();
 }
 
-void Render::init()
+void Render::init(const Config &config)
 {
-    initWindow();
+    m_config = config;
+
+    shaderFormat();
+    if (cameraCount() == 0 || cameraCount() > MAX_CAMERAS) {
+        throw std::runtime_error("unsupported number of cameras");
+    }
+    if (!m_config.dmaBuf && m_config.bufferNum == 0) {
+        throw std::runtime_error("no staging slots");
+    }
+    if (m_config.dmaBuf && isNv12()) {
+        throw std::runtime_error("dmabuf import of NV12 not supported");
+    }
+
+    if (!m_config.headless) {
+        m_deviceExtensions = deviceExtensions;
+    }
+    if (m_config.dmaBuf) {
+        m_deviceExtensions.insert(m_deviceExtensions.end(),
+                                  dmaBufDeviceExtensions.begin(),
+                                  dmaBufDeviceExtensions.end());
+    }
+
+    if (!m_config.headless) {
+        initWindow();
+    }
 
     createInstance();
 
@@ -104,103 +144,197 @@ void Render::init()
     setupDebugMessage();
 #endif
 
-    createSurface();
+    if (!m_config.headless) {
+        createSurface();
+    }
     pickPhysicalDevice();
+    if (isNv12()) {
+        m_ycbcr = checkYcbcrSupport();
+        std::cout << "NV12 via " << (m_ycbcr ? "sampler ycbcr conversion" :
+                                               "shader conversion")
+                  << std::endl;
+    }
+    if (m_ycbcr) {
+        m_deviceExtensions.push_back(VK_EXT_YCBCR_IMAGE_ARRAYS_EXTENSION_NAME);
+    }
     createLogicalDevice();
-    createSwapChain();
+    if (m_config.headless) {
+        createOffscreenImages();
+    } else {
+        createSwapChain();
+    }
     createImageViews();
     createRenderPass();
+    // the ycbcr sampler is immutable in the descriptor set layout
+    createTextureSampler();
     createDescriptorSetLayout();
+    createPipelineCache();
     createGraphicsPipeline();
+    // written now as well, a run that never exits cleanly still helps the
+    // next start
+    savePipelineCache();
     createFramebuffers();
     createCommandPool();
-    createTextureImage();
-    createTextureImageView();
-    createTextureSampler();
+    if (m_config.dmaBuf) {
+        importDmaBufs();
+    } else {
+        createTextureImage();
+        createTextureImageView();
+    }
+    initSlots();
     createVertexBuffer();
     createIndexBuffer();
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
     createCommandBuffers(0);
+    createUploadCommandBuffers();
+    createReadbackBuffers();
+    createTimestampQueries();
     createSyncObjects();
+    setLayout(Layout::grid(cameraCount()));
+    m_allocator->print(std::cout);
 }
 
-void Render::updateTexture(int index, int subIndex)
+void Render::setLayout(const Layout &layout)
 {
-    int imageWidth = 1280;
-    int imageHeight = 800;
-    int frameSize = imageWidth * imageHeight * 4;
+    if (layout.tiles().size() > MAX_TILES) {
+        throw std::runtime_error("too many layout tiles");
+    }
+    for (const auto &tile : layout.tiles()) {
+        if (tile.camera >= cameraCount()) {
+            throw std::runtime_error("layout shows a camera that is not there");
+        }
+    }
 
-    transitionImageLayout(*m_utextureImage, vk::ImageLayout::eUndefined,
-                          vk::ImageLayout::eTransferDstOptimal,
-                          vk::PipelineStageFlagBits::eTopOfPipe,
-                          vk::PipelineStageFlagBits::eTransfer);
-    vk::BufferImageCopy copyRegion(frameSize * (index * 4 + subIndex),
-                                   0, 0,
-                                   vk::ImageSubresourceLayers(
-                                       vk::ImageAspectFlagBits::eColor,
-                                       0, index, 1), vk::Offset3D(0, 0, 0),
-                                   vk::Extent3D(imageWidth, imageHeight, 1));
-    std::vector<vk::UniqueCommandBuffer> ucmdBuffers =
-        m_device->allocateCommandBuffersUnique(
-                vk::CommandBufferAllocateInfo(*m_commandPool,
-                                              vk::CommandBufferLevel::ePrimary,
-                                              1));
-    ucmdBuffers[0]->begin(
-            vk::CommandBufferBeginInfo(
-                vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
-    ucmdBuffers[0]->copyBufferToImage(*m_uStageBuffer, *m_utextureImage,
-                                         vk::ImageLayout::eTransferDstOptimal,
-                                         copyRegion);
-    ucmdBuffers[0]->end();
-    m_graphicsQueue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1,
-                                          &*ucmdBuffers[0]), {});
-    m_graphicsQueue.waitIdle();
-    transitionImageLayout(*m_utextureImage, vk::ImageLayout::eTransferDstOptimal,
-                          vk::ImageLayout::eShaderReadOnlyOptimal,
-                          vk::PipelineStageFlagBits::eTransfer,
-                          vk::PipelineStageFlagBits::eFragmentShader);
+    m_layout = layout;
+
+    // the tile rects only change here
+    m_uniforms = UniformBufferObject();
+    m_uniforms.model = glm::mat4(1.0f);
+    m_uniforms.view = glm::mat4(1.0f);
+    m_uniforms.proj = glm::mat4(1.0f);
+    const std::vector<Layout::Tile> &tiles = m_layout.tiles();
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const Layout::Tile &tile = tiles[i];
+        m_uniforms.rects[i] = glm::vec4(tile.x * 2.0f - 1.0f,
+                                        tile.y * 2.0f - 1.0f,
+                                        tile.width * 2.0f,
+                                        tile.height * 2.0f);
+        m_uniforms.layers[i / 4][i % 4] = -1;
+    }
+    m_uniformsVersion++;
+}
+
+void Render::updateTexture(int index, const Frame &frame)
+{
+    Frame &pending = m_pendingUploads.at(index);
 
+    // superseded before render, the GPU never saw it
+    if (pending.index != -1) {
+        countFrame(index, &StreamStats::superseded);
+        releaseSlot(index, pending.index);
+    }
+
+    pending = frame;
+    retainSlot(index, frame.index);
 }
 
-void Render::getBufferAddrs(int index, std::array<void *, 4> &bufferMaps)
+void Render::getBufferAddrs(int index, std::vector<void *> &bufferMaps)
 {
     bufferMaps = m_stageMemMaps[index];
 }
 
+vk::DeviceSize Render::frameSize()
+{
+    vk::DeviceSize pixels = m_config.imageWidth * m_config.imageHeight;
+
+    switch (m_config.pixelFormat) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        return pixels * 2;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+        return pixels * 3 / 2;
+    default:
+        return pixels * 4;
+    }
+}
+
 void Render::render(int index)
 {
+    retireCompletedFrames();
+
     m_device->waitForFences(1, &*m_inFlightFences.at(m_currentFrame),
                             VK_TRUE, std::numeric_limits<uint64_t>::max());
+    retireFrame(m_currentFrame);
 
-    uint32_t imageIndex;
-    vk::Result result =
-        m_device->acquireNextImageKHR(*m_swapChain,
+    // headless, each frame in flight has its own offscreen image
+    uint32_t imageIndex = m_currentFrame;
+    vk::Result result;
+    if (!m_config.headless) {
+        result = m_device->acquireNextImageKHR(*m_swapChain,
                                       std::numeric_limits<uint64_t>::max(),
                                       *m_imageAvailableSemaphores.at(m_currentFrame),
                                       nullptr, &imageIndex);
 
-    if (result == vk::Result::eErrorOutOfDateKHR) {
-        recreateSwapChain(index);
-        std::cout << "recreating" << std::endl;
-        return;
-    } else if (result != vk::Result::eSuccess &&
-               result != vk::Result::eSuboptimalKHR) {
-        throw std::runtime_error("failed to acquire swap chain image");
+        if (result == vk::Result::eErrorOutOfDateKHR) {
+            recreateSwapChain(index);
+            std::cout << "recreating" << std::endl;
+            return;
+        } else if (result != vk::Result::eSuccess &&
+                   result != vk::Result::eSuboptimalKHR) {
+            throw std::runtime_error("failed to acquire swap chain image");
+        }
     }
 
-    vk::ClearValue clearColor(
-            vk::ClearColorValue(
-                std::array<float, 4>({0.0f, 0.0f, 0.0f, 1.0f})));
-    updateUniformBuffer(imageIndex);
-
-    vk::PipelineStageFlags waitStages[] =
-        {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+    m_uploadSubmit.clear();
+    m_drawSubmit.clear();
+    bool uploaded = false;
+    if (m_config.dmaBuf) {
+        latchDmaBufs(m_currentFrame);
+    } else {
+        uploaded = queueUploads(m_currentFrame);
+    }
+    m_drawSubmit.push_back(*m_commandBuffers.at(
+        m_currentFrame * m_swapChainImages.size() + imageIndex));
+    bool readback = recordReadback(m_currentFrame, imageIndex);
+    if (readback) {
+        m_drawSubmit.push_back(*m_readbackCommandBuffers.at(m_currentFrame));
+    }
+    if (m_gpuProfiling) {
+        queueTimestamps(m_currentFrame, readback);
+    }
+    if (uploaded && m_dedicatedTransfer) {
+        submitUploads(m_currentFrame);
+    }
+    m_frameNumber++;
+
+    updateUniformBuffer(m_currentFrame);
+
+    // headless, nothing is acquired or presented
+    std::array<vk::Semaphore, 2> waitSemaphores;
+    std::array<vk::PipelineStageFlags, 2> waitStages;
+    uint32_t waitCount = 0;
+    uint32_t signalCount = 0;
+    if (!m_config.headless) {
+        waitSemaphores[waitCount] = *m_imageAvailableSemaphores.at(m_currentFrame);
+        waitStages[waitCount++] = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        signalCount = 1;
+    }
+    if (m_dedicatedTransfer && uploaded) {
+        // the acquire barriers come first in the submit and chain on
+        // this wait, the few vertices of the draw are not worth overlapping
+        waitSemaphores[waitCount] = *m_uploadDoneSemaphores.at(m_currentFrame);
+        waitStages[waitCount++] = vk::PipelineStageFlagBits::eTopOfPipe;
+    }
 
-    vk::SubmitInfo submitInfo(1, &*m_imageAvailableSemaphores.at(m_currentFrame),
-                              waitStages, 1, &*m_commandBuffers.at(imageIndex),
-                              1, &*m_renderFinishedSemaphores.at(m_currentFrame));
+    vk::SubmitInfo submitInfo(waitCount, waitSemaphores.data(),
+                              waitStages.data(),
+                              static_cast<uint32_t>(m_drawSubmit.size()),
+                              m_drawSubmit.data(),
+                              signalCount,
+                              &*m_renderFinishedSemaphores.at(m_currentFrame));
 
     m_device->resetFences(1, &*m_inFlightFences.at(m_currentFrame));
 
@@ -208,25 +342,260 @@ void Render::render(int index)
                                     *m_inFlightFences.at(m_currentFrame));
     if (result != vk::Result::eSuccess)
         throw std::runtime_error("failed to submit draw command buffer!");
+    destroyRetiredSwapChains();
 
-    vk::PresentInfoKHR
-        presentInfo(1, &*m_renderFinishedSemaphores.at(m_currentFrame),
-                    1, &*m_swapChain, &imageIndex);
-    result = m_presentQueue.presentKHR(presentInfo);
+    uint64_t submitTime = monotonicNs();
+    for (auto &frame : m_inFlightFrames.at(m_currentFrame)) {
+        frame.second.submitTime = submitTime;
+    }
 
-    if (result == vk::Result::eErrorOutOfDateKHR ||
-        result == vk::Result::eSuboptimalKHR ||
-        framebufferResized) {
-        framebufferResized = false;
-        recreateSwapChain(index);
-        std::cout << "recreating" << std::endl;
-    } else if (result != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to present swap chain image!");
+    if (!m_config.headless) {
+        vk::PresentInfoKHR
+            presentInfo(1, &*m_renderFinishedSemaphores.at(m_currentFrame),
+                        1, &*m_swapChain, &imageIndex);
+        result = m_presentQueue.presentKHR(presentInfo);
+
+        if (result == vk::Result::eErrorOutOfDateKHR ||
+            result == vk::Result::eSuboptimalKHR ||
+            framebufferResized) {
+            framebufferResized = false;
+            recreateSwapChain(index);
+            std::cout << "recreating" << std::endl;
+        } else if (result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to present swap chain image!");
+        }
     }
 
     m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
 
-    m_device->waitIdle();
+// picks the recorded uploads of the pending slots, nothing is recorded here
+bool Render::queueUploads(size_t frame)
+{
+    bool queued = false;
+
+    for (size_t i = 0; i < m_pendingUploads.size(); i++) {
+        int subIndex = m_pendingUploads[i].index;
+        if (subIndex == -1) {
+            continue;
+        }
+
+        // never a layer the frame still in flight samples, so the upload
+        // does not wait for any draw
+        uint32_t textureSlot = freeTextureSlot(frame, i);
+        m_textureSlots[i] = textureSlot;
+
+        vk::CommandBuffer upload = *m_uploadCommandBuffers.at(i).at(
+            subIndex * TEXTURE_SLOTS + textureSlot);
+        if (m_dedicatedTransfer) {
+            m_uploadSubmit.push_back(upload);
+            m_drawSubmit.push_back(*m_acquireCommandBuffers.at(
+                i * TEXTURE_SLOTS + textureSlot));
+        } else {
+            m_drawSubmit.push_back(upload);
+        }
+        queued = true;
+
+        m_inFlightSlots.at(frame).push_back(std::make_pair(i, subIndex));
+        m_inFlightFrames.at(frame).push_back(
+            std::make_pair(i, m_pendingUploads[i]));
+        countFrame(i, &StreamStats::displayed);
+        m_pendingUploads[i] = Frame();
+    }
+    m_inFlightTextures.at(frame) = m_textureSlots;
+
+    return queued;
+}
+
+// frame has retired, the others may still be in flight
+uint32_t Render::freeTextureSlot(size_t frame, uint32_t index)
+{
+    for (uint32_t slot = 0; slot < TEXTURE_SLOTS; slot++) {
+        bool sampled = false;
+        for (size_t i = 0; i < m_inFlightTextures.size(); i++) {
+            if (i != frame && m_inFlightTextures[i][index] == slot) {
+                sampled = true;
+                break;
+            }
+        }
+        if (!sampled) {
+            return slot;
+        }
+    }
+    throw std::runtime_error("no free texture slot");
+}
+
+void Render::submitUploads(size_t frame)
+{
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr,
+                              static_cast<uint32_t>(m_uploadSubmit.size()),
+                              m_uploadSubmit.data(),
+                              1, &*m_uploadDoneSemaphores.at(frame));
+
+    if (m_transferQueue.submit(1, &submitInfo, nullptr) !=
+            vk::Result::eSuccess) {
+        throw std::runtime_error("failed to submit upload command buffer");
+    }
+}
+
+// copies staging slot subIndex of a camera into texture layer(s) layer
+void Render::recordUploadCommandBuffer(vk::CommandBuffer cmd, uint32_t index,
+                                       uint32_t subIndex, uint32_t layer)
+{
+    cmd.begin(vk::CommandBufferBeginInfo());
+
+    // NV12 CbCr follows the luma plane
+    vk::DeviceSize offset =
+        frameSize() * (index * m_config.bufferNum + subIndex);
+    vk::DeviceSize chromaOffset =
+        offset + m_config.imageWidth * m_config.imageHeight;
+
+    if (m_ycbcr) {
+        recordUpload(cmd, *m_utextureImage, layer, {
+            copyRegion(offset, layer, textureExtent(),
+                       vk::ImageAspectFlagBits::ePlane0),
+            copyRegion(chromaOffset, layer, chromaExtent(),
+                       vk::ImageAspectFlagBits::ePlane1)});
+    } else {
+        recordUpload(cmd, *m_utextureImage, layer, {
+            copyRegion(offset, layer, textureExtent(),
+                       vk::ImageAspectFlagBits::eColor)});
+        if (m_uchromaImage) {
+            recordUpload(cmd, *m_uchromaImage, layer, {
+                copyRegion(chromaOffset, layer, chromaExtent(),
+                           vk::ImageAspectFlagBits::eColor)});
+        }
+    }
+
+    cmd.end();
+}
+
+void Render::recordUpload(vk::CommandBuffer cmd, vk::Image image,
+                          uint32_t layer,
+                          const std::vector<vk::BufferImageCopy> &regions)
+{
+    // the last draw sampling the layer has retired and the layer is
+    // overwritten, nothing has to be waited for or kept
+    recordImageBarrier(cmd, image,
+                       vk::ImageLayout::eUndefined,
+                       vk::ImageLayout::eTransferDstOptimal,
+                       vk::PipelineStageFlagBits::eTopOfPipe,
+                       vk::PipelineStageFlagBits::eTransfer, layer, 1);
+
+    cmd.copyBufferToImage(*m_uStageBuffer, image,
+                          vk::ImageLayout::eTransferDstOptimal,
+                          regions);
+
+    if (m_dedicatedTransfer) {
+        // released here, acquired by the draw once the upload semaphore
+        // has been waited for
+        recordImageBarrier(cmd, image,
+                           vk::ImageLayout::eTransferDstOptimal,
+                           vk::ImageLayout::eShaderReadOnlyOptimal,
+                           vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eBottomOfPipe, layer, 1,
+                           m_transferFamily, m_graphicsFamily);
+    } else {
+        recordImageBarrier(cmd, image,
+                           vk::ImageLayout::eTransferDstOptimal,
+                           vk::ImageLayout::eShaderReadOnlyOptimal,
+                           vk::PipelineStageFlagBits::eTransfer,
+                           vk::PipelineStageFlagBits::eFragmentShader,
+                           layer, 1);
+    }
+}
+
+vk::BufferImageCopy Render::copyRegion(vk::DeviceSize offset, uint32_t layer,
+                                       vk::Extent2D extent,
+                                       vk::ImageAspectFlagBits aspect)
+{
+    return vk::BufferImageCopy(offset, 0, 0,
+                               vk::ImageSubresourceLayers(aspect, 0, layer, 1),
+                               vk::Offset3D(0, 0, 0),
+                               vk::Extent3D(extent.width, extent.height, 1));
+}
+
+void Render::latchDmaBufs(size_t frame)
+{
+    for (size_t i = 0; i < m_pendingUploads.size(); i++) {
+        Frame &pending = m_pendingUploads[i];
+        int &current = m_currentSlots[i];
+
+        // the pending reference becomes the current one
+        if (pending.index != -1) {
+            if (current != -1) {
+                releaseSlot(i, current);
+            }
+            current = pending.index;
+            m_inFlightFrames.at(frame).push_back(std::make_pair(i, pending));
+            countFrame(i, &StreamStats::displayed);
+            pending = Frame();
+        }
+
+        if (current != -1) {
+            retainSlot(i, current);
+            m_inFlightSlots.at(frame).push_back(std::make_pair(i, current));
+        }
+    }
+}
+
+void Render::retainSlot(int index, int subIndex)
+{
+    m_slotRefs.at(index).at(subIndex)++;
+}
+
+void Render::releaseSlot(int index, int subIndex)
+{
+    int &refs = m_slotRefs.at(index).at(subIndex);
+
+    if (--refs == 0 && m_releaseCallback) {
+        m_releaseCallback(index, subIndex);
+    }
+}
+
+void Render::retireFrame(size_t frame)
+{
+    auto &slots = m_inFlightSlots.at(frame);
+
+    for (const auto &slot : slots) {
+        releaseSlot(slot.first, slot.second);
+    }
+    slots.clear();
+
+    // done is when the fence was seen signalled, not when it signalled
+    uint64_t doneTime = monotonicNs();
+    auto &frames = m_inFlightFrames.at(frame);
+    for (const auto &submitted : frames) {
+        m_latencyStats.record(submitted.first, submitted.second, doneTime);
+    }
+    frames.clear();
+
+    deliverReadback(frame);
+    resolveTimestamps(frame);
+}
+
+void Render::retireCompletedFrames()
+{
+    for (size_t i = 0; i < m_inFlightSlots.size(); i++) {
+        if (m_inFlightSlots[i].empty() &&
+            (m_inFlightReadbacks.empty() || m_inFlightReadbacks[i] == -1)) {
+            continue;
+        }
+
+        if (m_device->getFenceStatus(*m_inFlightFences.at(i)) ==
+                vk::Result::eSuccess) {
+            retireFrame(i);
+        }
+    }
+}
+
+void Render::countFrame(int index,
+                        std::atomic<uint64_t> StreamStats::*counter)
+{
+    if (index < static_cast<int>(m_streamStats.size()) &&
+        m_streamStats[index]) {
+        StreamStats::add(m_streamStats[index]->*counter);
+    }
 }
 
 bool Render::checkValidationLayerSupport()
@@ -263,16 +632,19 @@ void Render::initWindow()
     m_window = glfwCreateWindow(WIDTH, HEIGHT, "vulkan", nullptr, nullptr);
     glfwSetWindowUserPointer(m_window, this);
     glfwSetFramebufferSizeCallback(m_window, framebufferResizeCallback);
+    glfwSetKeyCallback(m_window, keyCallback);
 }
 
 std::vector<const char*> Render::getRequiredExtension()
 {
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> extensions;
 
-    std::vector<const char*> extensions(glfwExtensions,
-                                        glfwExtensions + glfwExtensionCount);
+    if (!m_config.headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
 #ifndef NDEBUG
     extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
@@ -289,11 +661,14 @@ void Render::createInstance()
     }
 #endif
 
-    if (!glfwVulkanSupported()) {
+    if (!m_config.headless && !glfwVulkanSupported()) {
         throw std::runtime_error("vulkan not supported!");
     }
 
-    vk::ApplicationInfo appInfo("triangle", 1, "vulkan", 1, VK_API_VERSION_1_0);
+    // external memory import and ycbcr conversion are vulkan 1.1 core
+    vk::ApplicationInfo appInfo("triangle", 1, "vulkan", 1,
+                                m_config.dmaBuf || isNv12() ?
+                                    VK_API_VERSION_1_1 : VK_API_VERSION_1_0);
     vk::InstanceCreateInfo instanceCreateInfo({}, &appInfo);
 
 #ifndef NDEBUG
@@ -387,8 +762,8 @@ bool Render::isDeviceSuitable(vk::PhysicalDevice device)
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    bool swapChainAdequate = m_config.headless;
+    if (extensionsSupported && !m_config.headless) {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
         swapChainAdequate = !swapChainSupport.formats.empty() &&
                             !swapChainSupport.presentModes.empty();
@@ -397,8 +772,15 @@ bool Render::isDeviceSuitable(vk::PhysicalDevice device)
     vk::PhysicalDeviceFeatures supportedFeatures =
         device.getFeatures();
 
+    bool dmaBufAdequate = true;
+    if (m_config.dmaBuf) {
+        dmaBufAdequate =
+            device.getProperties().apiVersion >= VK_API_VERSION_1_1 &&
+            supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+    }
+
     return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-           supportedFeatures.samplerAnisotropy;
+           supportedFeatures.samplerAnisotropy && dmaBufAdequate;
 }
 
 bool Render::checkDeviceExtensionSupport(vk::PhysicalDevice device)
@@ -406,8 +788,8 @@ bool Render::checkDeviceExtensionSupport(vk::PhysicalDevice device)
     std::vector<vk::ExtensionProperties> availableExtensions =
         device.enumerateDeviceExtensionProperties();
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                             deviceExtensions.end());
+    std::set<std::string> requiredExtensions(m_deviceExtensions.begin(),
+                                             m_deviceExtensions.end());
 
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -430,7 +812,11 @@ Render::QueueFamilyIndices Render::findQueueFamilies(vk::PhysicalDevice device)
             indices.graphicsFamily = i;
         }
 
-        VkBool32 presentSupport = device.getSurfaceSupportKHR(i, *m_surface);
+        // headless, the graphics queue stands in for the present queue
+        VkBool32 presentSupport = m_config.headless ?
+            static_cast<bool>(queueFamily.queueFlags &
+                              vk::QueueFlagBits::eGraphics) :
+            device.getSurfaceSupportKHR(i, *m_surface);
 
         if (queueFamily.queueCount > 0 && presentSupport) {
             indices.presentFamily = i;
@@ -443,6 +829,18 @@ Render::QueueFamilyIndices Render::findQueueFamilies(vk::PhysicalDevice device)
         i++;
     }
 
+    // copy engines show up as families without graphics and compute. Their
+    // transfer granularity may be coarse, the uploads copy whole layers.
+    for (uint32_t j = 0; j < queueFamilies.size(); j++) {
+        if (queueFamilies[j].queueCount > 0 &&
+            queueFamilies[j].queueFlags & vk::QueueFlagBits::eTransfer &&
+            !(queueFamilies[j].queueFlags & (vk::QueueFlagBits::eGraphics |
+                                             vk::QueueFlagBits::eCompute))) {
+            indices.transferFamily = j;
+            break;
+        }
+    }
+
     return indices;
 }
 
@@ -453,6 +851,13 @@ void Render::createLogicalDevice()
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies  = {indices.graphicsFamily,
                                                indices.presentFamily};
+    // dmabuf frames are sampled in place, there is nothing to upload
+    m_dedicatedTransfer = indices.transferFamily != uint32_t(-1) &&
+                          !m_config.dmaBuf;
+    m_graphicsFamily = indices.graphicsFamily;
+    m_transferFamily = m_dedicatedTransfer ? indices.transferFamily :
+                                             indices.graphicsFamily;
+    uniqueQueueFamilies.insert(m_transferFamily);
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -462,6 +867,11 @@ void Render::createLogicalDevice()
 
     vk::PhysicalDeviceFeatures deviceFeatures;
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = m_config.dmaBuf;
+
+    vk::PhysicalDeviceSamplerYcbcrConversionFeatures ycbcrFeatures(VK_TRUE);
+    vk::PhysicalDeviceYcbcrImageArraysFeaturesEXT ycbcrArrayFeatures(VK_TRUE);
+    ycbcrFeatures.pNext = &ycbcrArrayFeatures;
 
     vk::DeviceCreateInfo
         createInfo({}, static_cast<uint32_t>(queueCreateInfos.size()),
@@ -472,17 +882,31 @@ void Render::createLogicalDevice()
 #else
                    0, nullptr,
 #endif
-                   static_cast<uint32_t>(deviceExtensions.size()),
-                   deviceExtensions.data(),
+                   static_cast<uint32_t>(m_deviceExtensions.size()),
+                   m_deviceExtensions.data(),
                    &deviceFeatures);
+    if (m_ycbcr) {
+        createInfo.pNext = &ycbcrFeatures;
+    }
 
     m_device = m_physicalDevice.createDeviceUnique(createInfo);
 
+    if (m_config.dmaBuf) {
+        pfn_vkGetMemoryFdPropertiesKHR = (PFN_vkGetMemoryFdPropertiesKHR)
+            vkGetDeviceProcAddr(*m_device, "vkGetMemoryFdPropertiesKHR");
+    }
+
     m_graphicsQueue = m_device->getQueue(indices.graphicsFamily, 0);
     m_presentQueue = m_device->getQueue(indices.presentFamily, 0);
+    m_transferQueue = m_device->getQueue(m_transferFamily, 0);
+    m_allocator.reset(new MemoryAllocator(m_physicalDevice, *m_device));
+    if (m_dedicatedTransfer) {
+        std::cout << "uploads on transfer queue family " << m_transferFamily
+                  << std::endl;
+    }
 }
 
-void Render::createSwapChain()
+void Render::createSwapChain(vk::SwapchainKHR oldSwapChain)
 {
     SwapChainSupportDetails swapChainSupport =
         querySwapChainSupport(m_physicalDevice);
@@ -500,10 +924,18 @@ void Render::createSwapChain()
         imageCount = swapChainSupport.capabilities.maxImageCount;
     }
 
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment;
+    if (m_config.readbackDepth) {
+        if (!(swapChainSupport.capabilities.supportedUsageFlags &
+              vk::ImageUsageFlagBits::eTransferSrc)) {
+            throw std::runtime_error("swapchain images can not be read back");
+        }
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
+
     vk::SwapchainCreateInfoKHR
         createInfo({}, *m_surface, imageCount, surfaceFormat.format,
-                   surfaceFormat.colorSpace, extent, 1,
-                   vk::ImageUsageFlagBits::eColorAttachment);
+                   surfaceFormat.colorSpace, extent, 1, usage);
 
     QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
     uint32_t queueFamilyIndices[] = {indices.graphicsFamily,
@@ -521,6 +953,8 @@ void Render::createSwapChain()
     createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
+    // images of the old one already acquired can still be presented
+    createInfo.oldSwapchain = oldSwapChain;
 
     m_swapChain = m_device->createSwapchainKHRUnique(createInfo);
     m_swapChainImages = m_device->getSwapchainImagesKHR(*m_swapChain);
@@ -529,6 +963,36 @@ void Render::createSwapChain()
     m_swapChainExtent = extent;
 }
 
+void Render::createOffscreenImages()
+{
+    m_swapChainImageFormat = vk::Format::eR8G8B8A8Unorm;
+    m_swapChainExtent = vk::Extent2D(m_config.outputWidth,
+                                     m_config.outputHeight);
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vk::UniqueImage image = m_device->createImageUnique(
+                vk::ImageCreateInfo({}, vk::ImageType::e2D,
+                    m_swapChainImageFormat,
+                    vk::Extent3D(m_swapChainExtent.width,
+                                 m_swapChainExtent.height, 1),
+                    1, 1, vk::SampleCountFlagBits::e1,
+                    vk::ImageTiling::eOptimal,
+                    vk::ImageUsageFlagBits::eColorAttachment |
+                    vk::ImageUsageFlagBits::eTransferSrc,
+                    vk::SharingMode::eExclusive,
+                    0, nullptr, vk::ImageLayout::eUndefined));
+
+        MemoryAllocator::Allocation memory =
+            allocateMemory(m_device->getImageMemoryRequirements(*image),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal);
+        m_device->bindImageMemory(*image, memory.memory(), memory.offset());
+
+        m_swapChainImages.push_back(*image);
+        m_offscreenImages.push_back(std::move(image));
+        m_offscreenMems.push_back(std::move(memory));
+    }
+}
+
 Render::SwapChainSupportDetails
     Render::querySwapChainSupport(vk::PhysicalDevice device)
 {
@@ -625,14 +1089,24 @@ void Render::createDescriptorSetLayout()
             vk::ShaderStageFlagBits::eVertex);
 
     vk::DescriptorSetLayoutBinding samplerLayoutBinding(
-            1, vk::DescriptorType::eCombinedImageSampler, 1,
+            1, vk::DescriptorType::eCombinedImageSampler, textureCount(),
+            vk::ShaderStageFlagBits::eFragment);
+
+    vk::DescriptorSetLayoutBinding chromaLayoutBinding(
+            2, vk::DescriptorType::eCombinedImageSampler, 1,
             vk::ShaderStageFlagBits::eFragment);
 
-    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
-        uboLayoutBinding, samplerLayoutBinding};
+    if (m_ycbcr) {
+        samplerLayoutBinding.pImmutableSamplers = &*m_utextureSampler;
+        chromaLayoutBinding.pImmutableSamplers = &*m_utextureSampler;
+    }
+
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+        uboLayoutBinding, samplerLayoutBinding, chromaLayoutBinding};
 
     m_descriptorSetLayout = m_device->createDescriptorSetLayoutUnique(
-            vk::DescriptorSetLayoutCreateInfo({}, 2, bindings.data()));
+            vk::DescriptorSetLayoutCreateInfo({}, bindings.size(),
+                                              bindings.data()));
 }
 
 void Render::createRenderPass()
@@ -644,7 +1118,9 @@ void Render::createRenderPass()
                                               vk::AttachmentLoadOp::eDontCare,
                                               vk::AttachmentStoreOp::eDontCare,
                                               vk::ImageLayout::eUndefined,
-                                              vk::ImageLayout::ePresentSrcKHR);
+                                              m_config.headless ?
+                                                vk::ImageLayout::eTransferSrcOptimal :
+                                                vk::ImageLayout::ePresentSrcKHR);
 
     vk::AttachmentReference
         colorAttachmentRef(0, vk::ImageLayout::eColorAttachmentOptimal);
@@ -659,26 +1135,94 @@ void Render::createRenderPass()
     m_renderPass = m_device->createRenderPassUnique(renderPassInfo);
 }
 
-void Render::createGraphicsPipeline()
+void Render::createPipelineCache()
 {
-    auto vertShaderCode = readFile("shader.vert.spv");
-    auto fragShaderCode = readFile("shader.frag.spv");
+    std::vector<char> data;
+    if (!m_config.pipelineCache.empty()) {
+        data = readFile(m_config.pipelineCache);
+    }
 
-    if (vertShaderCode.size() == 0 || fragShaderCode.size() == 0) {
-        throw std::runtime_error("createGraphicsPipeline failed");
+    // the driver should reject foreign data itself, not all of them do
+    if (!data.empty()) {
+        vk::PhysicalDeviceProperties properties =
+            m_physicalDevice.getProperties();
+        uint32_t header[4];
+        bool valid = data.size() >= sizeof(header) + VK_UUID_SIZE;
+        if (valid) {
+            std::memcpy(header, data.data(), sizeof(header));
+            valid = header[0] >= sizeof(header) + VK_UUID_SIZE &&
+                header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                header[2] == properties.vendorID &&
+                header[3] == properties.deviceID &&
+                std::memcmp(data.data() + sizeof(header),
+                            properties.pipelineCacheUUID,
+                            VK_UUID_SIZE) == 0;
+        }
+        if (!valid) {
+            std::cout << m_config.pipelineCache
+                      << " is from another device or driver, ignored"
+                      << std::endl;
+            data.clear();
+        }
+    }
+
+    m_pipelineCache = m_device->createPipelineCacheUnique(
+            vk::PipelineCacheCreateInfo({}, data.size(), data.data()));
+    m_pipelineCacheSaved = data.size();
+}
+
+void Render::savePipelineCache()
+{
+    if (!m_pipelineCache || m_config.pipelineCache.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> data =
+        m_device->getPipelineCacheData(*m_pipelineCache);
+    if (data.size() == m_pipelineCacheSaved) {
+        return;
+    }
+
+    // renamed into place so a crash never leaves half a cache behind
+    std::string tmpName = m_config.pipelineCache + ".tmp";
+    std::ofstream file(tmpName, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.close();
+    if (!file || std::rename(tmpName.c_str(),
+                             m_config.pipelineCache.c_str()) != 0) {
+        std::cout << "failed to write " << m_config.pipelineCache
+                  << std::endl;
+        std::remove(tmpName.c_str());
+        return;
     }
+    m_pipelineCacheSaved = data.size();
+}
 
-    vk::UniqueShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    vk::UniqueShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+void Render::createGraphicsPipeline()
+{
+    vk::UniqueShaderModule vertShaderModule =
+        createShaderModule(shader_vert, sizeof(shader_vert));
+    vk::UniqueShaderModule fragShaderModule = m_config.dmaBuf ?
+        createShaderModule(dmabuf_frag, sizeof(dmabuf_frag)) :
+        createShaderModule(shader_frag, sizeof(shader_frag));
     if (!vertShaderModule || !fragShaderModule) {
         throw std::runtime_error("createGraphicsPipeline failed");
     }
 
+    // constant_id 0: number of sampled images, 1: pixel format
+    std::array<uint32_t, 2> specData = {textureCount(), shaderFormat()};
+    std::array<vk::SpecializationMapEntry, 2> specEntries = {
+        vk::SpecializationMapEntry(0, 0, sizeof(uint32_t)),
+        vk::SpecializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t))};
+    vk::SpecializationInfo specInfo(specEntries.size(), specEntries.data(),
+                                    sizeof(specData), specData.data());
+
     vk::PipelineShaderStageCreateInfo shaderStages[2] = {
         vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex,
                                           *vertShaderModule, "main"),
         vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment,
-                                          *fragShaderModule, "main")};
+                                          *fragShaderModule, "main",
+                                          &specInfo)};
 
     auto bindingDescription = Vertex::getBindingDescription();
     auto attributeDescriptions = Vertex::getAttributeDescriptions();
@@ -690,13 +1234,13 @@ void Render::createGraphicsPipeline()
     vk::PipelineInputAssemblyStateCreateInfo inputAssembly(
             {}, vk::PrimitiveTopology::eTriangleStrip);
 
-    vk::Viewport viewport(0.0f, 0.0f, (float)m_swapChainExtent.width,
-                          (float)m_swapChainExtent.height, 0.0f, 1.0f);
-
-    vk::Rect2D scissor(vk::Offset2D(), m_swapChainExtent);
-
+    // set in the command buffers, a resize keeps the pipeline
     vk::PipelineViewportStateCreateInfo viewportState(
-            {}, 1, &viewport, 1, &scissor);
+            {}, 1, nullptr, 1, nullptr);
+    std::array<vk::DynamicState, 2> dynamicStates = {
+        vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState(
+            {}, dynamicStates.size(), dynamicStates.data());
 
     vk::PipelineRasterizationStateCreateInfo rasterizer(
             {}, VK_FALSE, VK_FALSE, vk::PolygonMode::eFill,
@@ -721,11 +1265,11 @@ void Render::createGraphicsPipeline()
     vk::GraphicsPipelineCreateInfo pipelineInfo(
             {}, 2, shaderStages, &vertexInputInfo, &inputAssembly,
             nullptr, &viewportState, &rasterizer, &multisampling,
-            nullptr, &colorBlending, nullptr, *m_pipelineLayout,
+            nullptr, &colorBlending, &dynamicState, *m_pipelineLayout,
             *m_renderPass);
 
-    m_graphicsPipeline = m_device->createGraphicsPipelineUnique(nullptr,
-                                                                pipelineInfo);
+    m_graphicsPipeline = m_device->createGraphicsPipelineUnique(
+            *m_pipelineCache, pipelineInfo);
 }
 
 std::vector<char> Render::readFile(const std::string& filename)
@@ -746,13 +1290,10 @@ std::vector<char> Render::readFile(const std::string& filename)
     return buffer;
 }
 
-vk::UniqueShaderModule Render::createShaderModule(const std::vector<char>& code)
+vk::UniqueShaderModule Render::createShaderModule(const uint32_t *code,
+                                                  size_t size)
 {
-    int ret;
-
-    vk::ShaderModuleCreateInfo
-        createInfo({}, code.size(),
-                   reinterpret_cast<const uint32_t*>(code.data()));
+    vk::ShaderModuleCreateInfo createInfo({}, size, code);
 
     return m_device->createShaderModuleUnique(createInfo);
 }
@@ -779,12 +1320,20 @@ void Render::createCommandPool()
     m_commandPool = m_device->createCommandPoolUnique(
             vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
 									  queueFamilyIndices.graphicsFamily));
+
+    if (m_dedicatedTransfer) {
+        m_transferCommandPool = m_device->createCommandPoolUnique(
+                vk::CommandPoolCreateInfo(
+                    vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                    m_transferFamily));
+    }
 }
 
 void Render::transitionImageLayout(vk::Image image, vk::ImageLayout oldLayout,
                            vk::ImageLayout newLayout,
                            vk::PipelineStageFlags srcStageMask,
-                           vk::PipelineStageFlags dstStageMask)
+                           vk::PipelineStageFlags dstStageMask,
+                           uint32_t layerCount)
 {
     std::vector<vk::UniqueCommandBuffer> ucmdBuffers =
         m_device->allocateCommandBuffersUnique(
@@ -795,6 +1344,25 @@ void Render::transitionImageLayout(vk::Image image, vk::ImageLayout oldLayout,
             vk::CommandBufferBeginInfo(
                 vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
 
+    recordImageBarrier(*ucmdBuffers[0], image, oldLayout, newLayout,
+                       srcStageMask, dstStageMask, 0, layerCount);
+
+    ucmdBuffers[0]->end();
+
+    m_graphicsQueue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1,
+                                          &*ucmdBuffers[0]), {});
+    m_graphicsQueue.waitIdle();
+}
+
+void Render::recordImageBarrier(vk::CommandBuffer cmd, vk::Image image,
+                                vk::ImageLayout oldLayout,
+                                vk::ImageLayout newLayout,
+                                vk::PipelineStageFlags srcStageMask,
+                                vk::PipelineStageFlags dstStageMask,
+                                uint32_t baseLayer, uint32_t layerCount,
+                                uint32_t srcQueueFamily,
+                                uint32_t dstQueueFamily)
+{
     vk::AccessFlags  srcAccessMask;
     switch (oldLayout) {
     case vk::ImageLayout::eColorAttachmentOptimal:
@@ -806,6 +1374,9 @@ void Render::transitionImageLayout(vk::Image image, vk::ImageLayout oldLayout,
     case vk::ImageLayout::ePreinitialized:
         srcAccessMask = vk::AccessFlagBits::eHostWrite;
         break;
+    case vk::ImageLayout::eShaderReadOnlyOptimal:
+        srcAccessMask = vk::AccessFlagBits::eShaderRead;
+        break;
     default:
         break;
     }
@@ -827,90 +1398,414 @@ void Render::transitionImageLayout(vk::Image image, vk::ImageLayout oldLayout,
     case vk::ImageLayout::eDepthStencilAttachmentOptimal:
         dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
         break;
+    case vk::ImageLayout::eGeneral:
+        dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        break;
     default:
         break;
     }
 
+    // top and bottom of pipe access no memory; this is also the acquire
+    // and release half of a queue family transfer, where the access on
+    // the other queue's side is ignored
+    if (srcStageMask == vk::PipelineStageFlags(
+            vk::PipelineStageFlagBits::eTopOfPipe)) {
+        srcAccessMask = vk::AccessFlags();
+    }
+    if (dstStageMask == vk::PipelineStageFlags(
+            vk::PipelineStageFlagBits::eBottomOfPipe)) {
+        dstAccessMask = vk::AccessFlags();
+    }
+
     vk::ImageSubresourceRange
         imageSubresourceRange(vk::ImageAspectFlagBits::eColor,
-                              0, 1, 0, 4); //TODO layer count dyn
+                              0, 1, baseLayer, layerCount);
     vk::ImageMemoryBarrier imageMemoryBarrier(srcAccessMask, dstAccessMask,
                                               oldLayout, newLayout,
-                                              VK_QUEUE_FAMILY_IGNORED,
-                                              VK_QUEUE_FAMILY_IGNORED,
+                                              srcQueueFamily, dstQueueFamily,
                                               image, imageSubresourceRange);
-    ucmdBuffers[0]->pipelineBarrier(srcStageMask, dstStageMask, {}, nullptr,
-                                nullptr, imageMemoryBarrier);
-
-    ucmdBuffers[0]->end();
-
-    m_graphicsQueue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1,
-                                          &*ucmdBuffers[0]), {});
-    m_graphicsQueue.waitIdle();
+    cmd.pipelineBarrier(srcStageMask, dstStageMask, {}, nullptr,
+                        nullptr, imageMemoryBarrier);
 }
 
 void Render::createTextureImage()
 {
-    int imageWidth = 1280;
-    int imageHeight = 800;
-    int frameSize = imageWidth * imageHeight * 4;
-
-    m_stageMemMaps.resize(4);
+    m_stageMemMaps.assign(cameraCount(),
+                          std::vector<void *>(m_config.bufferNum));
+    vk::DeviceSize stageSize =
+        frameSize() * cameraCount() * m_config.bufferNum;
 
     m_uStageBuffer = m_device->createBufferUnique(
-            vk::BufferCreateInfo({}, frameSize * 16,
+            vk::BufferCreateInfo({}, stageSize,
                 vk::BufferUsageFlagBits::eTransferSrc));
-    vk::MemoryRequirements stageMemReq = m_device->getBufferMemoryRequirements(*m_uStageBuffer);
-    uint32_t stageMemTypeIndex =
-        findMemoryType(stageMemReq.memoryTypeBits,
-                vk::MemoryPropertyFlagBits::eHostVisible |
-                vk::MemoryPropertyFlagBits::eHostCoherent);
-    m_uStageMem = m_device->allocateMemoryUnique(
-            vk::MemoryAllocateInfo(stageMemReq.size, stageMemTypeIndex));
-    m_device->bindBufferMemory(*m_uStageBuffer, *m_uStageMem, 0);
-
-    void *data = m_device->mapMemory(*m_uStageMem, 0, frameSize * 16);
+    m_uStageMem = allocateMemory(
+            m_device->getBufferMemoryRequirements(*m_uStageBuffer),
+            vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_device->bindBufferMemory(*m_uStageBuffer, m_uStageMem.memory(),
+                               m_uStageMem.offset());
+
+    void *data = m_uStageMem.map();
     for (size_t i = 0; i < m_stageMemMaps.size(); i++) {
         for (size_t j = 0; j < m_stageMemMaps[i].size(); j++) {
             m_stageMemMaps[i][j] = data;
-            data = static_cast<char*>(data) + frameSize;
+            data = static_cast<char*>(data) + frameSize();
         }
     }
 
-    m_utextureImage = m_device->createImageUnique(
+    createTextureArray(textureFormat(), textureExtent(),
+                       m_utextureImage, m_utextureMem);
+    if (isNv12() && !m_ycbcr) {
+        createTextureArray(vk::Format::eR8G8Unorm, chromaExtent(),
+                           m_uchromaImage, m_uchromaMem);
+    }
+}
+
+void Render::createTextureArray(vk::Format format, vk::Extent2D extent,
+                                vk::UniqueImage &image,
+                                MemoryAllocator::Allocation &memory)
+{
+    image = m_device->createImageUnique(
             vk::ImageCreateInfo({}, vk::ImageType::e2D,
-                vk::Format::eR8G8B8A8Unorm,
-                vk::Extent3D(imageWidth, imageHeight, 1),
-                1, 4, vk::SampleCountFlagBits::e1, // TODO layout number dynamic
+                format,
+                vk::Extent3D(extent.width, extent.height, 1),
+                1, textureLayerCount(), vk::SampleCountFlagBits::e1,
                 vk::ImageTiling::eOptimal,
                 vk::ImageUsageFlagBits::eSampled |
                 vk::ImageUsageFlagBits::eTransferDst,
                 vk::SharingMode::eExclusive,
                 0, nullptr, vk::ImageLayout::eUndefined));
 
-    vk::MemoryRequirements memoryRequirements =
-        m_device->getImageMemoryRequirements(*m_utextureImage);
-    uint32_t memoryTypeIndex =
-        findMemoryType(memoryRequirements.memoryTypeBits,
-                vk::MemoryPropertyFlagBits::eDeviceLocal);
-    m_utextureMem = m_device->allocateMemoryUnique(
-            vk::MemoryAllocateInfo(memoryRequirements.size, memoryTypeIndex));
-    m_device->bindImageMemory(*m_utextureImage, *m_utextureMem, 0);
+    memory = allocateMemory(m_device->getImageMemoryRequirements(*image),
+                            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    m_device->bindImageMemory(*image, memory.memory(), memory.offset());
+
+    transitionImageLayout(*image, vk::ImageLayout::eUndefined,
+                          vk::ImageLayout::eShaderReadOnlyOptimal,
+                          vk::PipelineStageFlagBits::eTopOfPipe,
+                          vk::PipelineStageFlagBits::eFragmentShader,
+                          textureLayerCount());
 }
 
 void Render::createTextureImageView()
 {
-    m_utextureImageView = m_device->createImageViewUnique(
-            vk::ImageViewCreateInfo({}, *m_utextureImage,
-                vk::ImageViewType::e2DArray,
-                vk::Format::eR8G8B8A8Unorm, {},
-                vk::ImageSubresourceRange(
-                    vk::ImageAspectFlagBits::eColor,
-                    0, 1, 0, 4)));
+    vk::ImageViewCreateInfo viewInfo({}, *m_utextureImage,
+            vk::ImageViewType::e2DArray,
+            textureFormat(), {},
+            vk::ImageSubresourceRange(
+                vk::ImageAspectFlagBits::eColor,
+                0, 1, 0, textureLayerCount()));
+
+    vk::SamplerYcbcrConversionInfo conversionInfo;
+    if (m_ycbcr) {
+        conversionInfo.conversion = *m_ycbcrConversion;
+        viewInfo.pNext = &conversionInfo;
+    }
+
+    m_utextureImageView = m_device->createImageViewUnique(viewInfo);
+
+    if (m_uchromaImage) {
+        m_uchromaImageView = m_device->createImageViewUnique(
+                vk::ImageViewCreateInfo({}, *m_uchromaImage,
+                    vk::ImageViewType::e2DArray,
+                    vk::Format::eR8G8Unorm, {},
+                    vk::ImageSubresourceRange(
+                        vk::ImageAspectFlagBits::eColor,
+                        0, 1, 0, textureLayerCount())));
+    }
+}
+
+vk::Format Render::textureFormat()
+{
+    // packed 4:2:2 is uploaded as one RGBA texel per two pixels
+    if (m_ycbcr) {
+        return vk::Format::eG8B8R82Plane420Unorm;
+    } else if (isNv12()) {
+        return vk::Format::eR8Unorm;
+    }
+    return vk::Format::eR8G8B8A8Unorm;
+}
+
+vk::Extent2D Render::textureExtent()
+{
+    switch (m_config.pixelFormat) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        return vk::Extent2D(m_config.imageWidth / 2, m_config.imageHeight);
+    default:
+        return vk::Extent2D(m_config.imageWidth, m_config.imageHeight);
+    }
+}
+
+vk::Extent2D Render::chromaExtent()
+{
+    return vk::Extent2D(m_config.imageWidth / 2, m_config.imageHeight / 2);
+}
+
+// matches the FORMAT_* constants in yuv.glsl
+uint32_t Render::shaderFormat()
+{
+    switch (m_config.pixelFormat) {
+    case V4L2_PIX_FMT_XBGR32:
+        return 0;
+    case V4L2_PIX_FMT_YUYV:
+        return 1;
+    case V4L2_PIX_FMT_UYVY:
+        return 2;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+        // the ycbcr sampler already returns RGB
+        return m_ycbcr ? 0 : 3;
+    default:
+        throw std::runtime_error("unsupported pixel format");
+    }
+}
+
+bool Render::isNv12()
+{
+    return m_config.pixelFormat == V4L2_PIX_FMT_NV12 ||
+           m_config.pixelFormat == V4L2_PIX_FMT_NV12M;
+}
+
+bool Render::checkYcbcrSupport()
+{
+    if (m_physicalDevice.getProperties().apiVersion < VK_API_VERSION_1_1) {
+        return false;
+    }
+
+    // one camera per array layer needs VK_EXT_ycbcr_image_arrays
+    bool imageArrays = false;
+    for (const auto &extension :
+            m_physicalDevice.enumerateDeviceExtensionProperties()) {
+        if (strcmp(extension.extensionName,
+                   VK_EXT_YCBCR_IMAGE_ARRAYS_EXTENSION_NAME) == 0) {
+            imageArrays = true;
+            break;
+        }
+    }
+    if (!imageArrays) {
+        return false;
+    }
+
+    vk::PhysicalDeviceYcbcrImageArraysFeaturesEXT ycbcrArrayFeatures;
+    vk::PhysicalDeviceSamplerYcbcrConversionFeatures ycbcrFeatures;
+    ycbcrFeatures.pNext = &ycbcrArrayFeatures;
+    vk::PhysicalDeviceFeatures2 features;
+    features.pNext = &ycbcrFeatures;
+    m_physicalDevice.getFeatures2(&features);
+    if (!ycbcrFeatures.samplerYcbcrConversion ||
+        !ycbcrArrayFeatures.ycbcrImageArrays) {
+        return false;
+    }
+
+    vk::Format format = vk::Format::eG8B8R82Plane420Unorm;
+    vk::FormatFeatureFlags formatFeatures =
+        m_physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+    if (!(formatFeatures & vk::FormatFeatureFlagBits::eSampledImage) ||
+        !(formatFeatures & vk::FormatFeatureFlagBits::eTransferDst) ||
+        !(formatFeatures & (vk::FormatFeatureFlagBits::eMidpointChromaSamples |
+                            vk::FormatFeatureFlagBits::eCositedChromaSamples))) {
+        return false;
+    }
+
+    vk::PhysicalDeviceImageFormatInfo2 formatInfo(format, vk::ImageType::e2D,
+            vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferDst);
+    vk::SamplerYcbcrConversionImageFormatProperties ycbcrProperties;
+    vk::ImageFormatProperties2 formatProperties;
+    formatProperties.pNext = &ycbcrProperties;
+    if (m_physicalDevice.getImageFormatProperties2(&formatInfo,
+                                                   &formatProperties) !=
+            vk::Result::eSuccess ||
+        formatProperties.imageFormatProperties.maxArrayLayers <
+            textureLayerCount()) {
+        return false;
+    }
+
+    m_ycbcrDescriptorCount =
+        std::max(1u, ycbcrProperties.combinedImageSamplerDescriptorCount);
+
+    return true;
+}
+
+void Render::importDmaBufs()
+{
+    vk::Format format = textureFormat();
+    vk::Extent2D extent = textureExtent();
+
+    vk::FormatProperties formatProperties =
+        m_physicalDevice.getFormatProperties(format);
+    if (!(formatProperties.linearTilingFeatures &
+          vk::FormatFeatureFlagBits::eSampledImage)) {
+        throw std::runtime_error("linear sampled image not supported");
+    }
+
+    for (const auto &camera : m_config.dmaBufs) {
+        m_dmaBufBase.push_back(m_dmaBufImages.size());
+
+        for (int fd : camera.fds) {
+            vk::ExternalMemoryImageCreateInfo externalInfo(
+                    vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT);
+            vk::ImageCreateInfo imageInfo({}, vk::ImageType::e2D, format,
+                    vk::Extent3D(extent.width, extent.height, 1),
+                    1, 1, vk::SampleCountFlagBits::e1,
+                    vk::ImageTiling::eLinear,
+                    vk::ImageUsageFlagBits::eSampled,
+                    vk::SharingMode::eExclusive,
+                    0, nullptr, vk::ImageLayout::ePreinitialized);
+            imageInfo.pNext = &externalInfo;
+
+            vk::UniqueImage image = m_device->createImageUnique(imageInfo);
+
+            // a linear image can not be told the V4L2 stride, it has to match
+            vk::SubresourceLayout layout = m_device->getImageSubresourceLayout(
+                    *image, vk::ImageSubresource(
+                        vk::ImageAspectFlagBits::eColor, 0, 0));
+            if (layout.offset != 0 || layout.rowPitch != camera.bytesPerLine) {
+                throw std::runtime_error("dmabuf stride does not match");
+            }
+
+            vk::MemoryRequirements memRequirements =
+                m_device->getImageMemoryRequirements(*image);
+
+            // the import takes ownership of the fd, hand it a duplicate
+            int importFd = ::dup(fd);
+            if (importFd == -1) {
+                throw std::runtime_error("failed to dup dmabuf");
+            }
+
+            vk::MemoryFdPropertiesKHR fdProperties;
+            uint32_t memoryTypeIndex;
+            vk::UniqueDeviceMemory memory;
+            try {
+                fdProperties = m_device->getMemoryFdPropertiesKHR(
+                        vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT,
+                        importFd);
+                memoryTypeIndex =
+                    findMemoryType(memRequirements.memoryTypeBits &
+                                   fdProperties.memoryTypeBits, {});
+
+                vk::MemoryDedicatedAllocateInfo dedicatedInfo(*image);
+                vk::ImportMemoryFdInfoKHR importInfo(
+                        vk::ExternalMemoryHandleTypeFlagBits::eDmaBufEXT,
+                        importFd);
+                importInfo.pNext = &dedicatedInfo;
+                vk::MemoryAllocateInfo allocInfo(memRequirements.size,
+                                                 memoryTypeIndex);
+                allocInfo.pNext = &importInfo;
+
+                memory = m_device->allocateMemoryUnique(allocInfo);
+            } catch (...) {
+                ::close(importFd);
+                throw;
+            }
+            m_device->bindImageMemory(*image, *memory, 0);
+
+            // preinitialized keeps whatever the capture device wrote
+            transitionImageLayout(*image, vk::ImageLayout::ePreinitialized,
+                                  vk::ImageLayout::eGeneral,
+                                  vk::PipelineStageFlagBits::eTopOfPipe,
+                                  vk::PipelineStageFlagBits::eFragmentShader,
+                                  1);
+
+            m_dmaBufImageViews.push_back(m_device->createImageViewUnique(
+                    vk::ImageViewCreateInfo({}, *image, vk::ImageViewType::e2D,
+                        format, {},
+                        vk::ImageSubresourceRange(
+                            vk::ImageAspectFlagBits::eColor,
+                            0, 1, 0, 1))));
+            m_dmaBufImages.push_back(std::move(image));
+            m_dmaBufMems.push_back(std::move(memory));
+        }
+    }
+
+    if (m_dmaBufImages.empty()) {
+        throw std::runtime_error("no dmabuf to import");
+    }
+}
+
+void Render::initSlots()
+{
+    size_t cameraNum = cameraCount();
+
+    m_pendingUploads.assign(cameraNum, Frame());
+    m_currentSlots.assign(cameraNum, -1);
+    m_textureSlots.assign(cameraNum, 0);
+    m_inFlightTextures.assign(MAX_FRAMES_IN_FLIGHT,
+                              std::vector<uint32_t>(cameraNum, 0));
+    m_slotRefs.resize(cameraNum);
+    for (size_t i = 0; i < cameraNum; i++) {
+        m_slotRefs[i].assign(m_config.dmaBuf ? m_config.dmaBufs[i].fds.size() :
+                                               m_config.bufferNum, 0);
+    }
+    m_inFlightSlots.resize(MAX_FRAMES_IN_FLIGHT);
+    m_inFlightFrames.resize(MAX_FRAMES_IN_FLIGHT);
+    m_latencyStats.resize(cameraNum);
+}
+
+uint32_t Render::cameraCount()
+{
+    return m_config.dmaBuf ? m_config.dmaBufs.size() : m_config.cameraNum;
+}
+
+uint32_t Render::textureLayerCount()
+{
+    return cameraCount() * TEXTURE_SLOTS;
+}
+
+uint32_t Render::textureCount()
+{
+    if (!m_config.dmaBuf) {
+        return 1;
+    }
+
+    uint32_t count = 0;
+    for (const auto &camera : m_config.dmaBufs) {
+        count += camera.fds.size();
+    }
+    return count;
 }
 
 void Render::createTextureSampler()
 {
+    if (m_ycbcr) {
+        vk::Format format = textureFormat();
+        vk::FormatFeatureFlags formatFeatures =
+            m_physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+
+        vk::Filter filter = (formatFeatures &
+            vk::FormatFeatureFlagBits::eSampledImageYcbcrConversionLinearFilter) ?
+                vk::Filter::eLinear : vk::Filter::eNearest;
+        // V4L2 NV12 is usually co-sited horizontally, centered vertically
+        vk::ChromaLocation xOffset =
+            (formatFeatures & vk::FormatFeatureFlagBits::eCositedChromaSamples) ?
+                vk::ChromaLocation::eCositedEven : vk::ChromaLocation::eMidpoint;
+        vk::ChromaLocation yOffset =
+            (formatFeatures & vk::FormatFeatureFlagBits::eMidpointChromaSamples) ?
+                vk::ChromaLocation::eMidpoint : vk::ChromaLocation::eCositedEven;
+
+        m_ycbcrConversion = m_device->createSamplerYcbcrConversionUnique(
+                vk::SamplerYcbcrConversionCreateInfo(format,
+                    vk::SamplerYcbcrModelConversion::eYcbcr601,
+                    vk::SamplerYcbcrRange::eItuNarrow,
+                    vk::ComponentMapping(), xOffset, yOffset,
+                    filter, VK_FALSE));
+
+        vk::SamplerYcbcrConversionInfo conversionInfo(*m_ycbcrConversion);
+        vk::SamplerCreateInfo samplerInfo({}, filter, filter,
+                                          vk::SamplerMipmapMode::eNearest,
+                                          vk::SamplerAddressMode::eClampToEdge,
+                                          vk::SamplerAddressMode::eClampToEdge,
+                                          vk::SamplerAddressMode::eClampToEdge,
+                                          0, VK_FALSE, 1, VK_FALSE,
+                                          vk::CompareOp::eAlways);
+        samplerInfo.pNext = &conversionInfo;
+
+        m_utextureSampler = m_device->createSamplerUnique(samplerInfo);
+        return;
+    }
+
     m_utextureSampler = m_device->createSamplerUnique(
             vk::SamplerCreateInfo({}, vk::Filter::eLinear, vk::Filter::eLinear,
                                   vk::SamplerMipmapMode::eLinear,
@@ -928,22 +1823,15 @@ void Render::createVertexBuffer()
     m_uVertexBuffer = m_device->createBufferUnique(
             vk::BufferCreateInfo({}, bufferSize,
                 vk::BufferUsageFlagBits::eVertexBuffer));
-    vk::MemoryRequirements memRequirements =
-        m_device->getBufferMemoryRequirements(*m_uVertexBuffer);
-
-    uint32_t memoryTypeIndex =
-        findMemoryType(memRequirements.memoryTypeBits,
-                vk::MemoryPropertyFlagBits::eHostVisible |
-                vk::MemoryPropertyFlagBits::eHostCoherent);
-    m_uVertexBufferMem = m_device->allocateMemoryUnique(
-            vk::MemoryAllocateInfo(memRequirements.size, memoryTypeIndex));
+    m_uVertexBufferMem = allocateMemory(
+            m_device->getBufferMemoryRequirements(*m_uVertexBuffer),
+            vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
 
-    void *data = m_device->mapMemory(*m_uVertexBufferMem, 0,
-            memRequirements.size);
-    memcpy(data, vertices.data(), bufferSize);
-    m_device->unmapMemory(*m_uVertexBufferMem);
+    memcpy(m_uVertexBufferMem.map(), vertices.data(), bufferSize);
 
-    m_device->bindBufferMemory(*m_uVertexBuffer, *m_uVertexBufferMem, 0);
+    m_device->bindBufferMemory(*m_uVertexBuffer, m_uVertexBufferMem.memory(),
+                               m_uVertexBufferMem.offset());
 }
 
 void Render::createIndexBuffer()
@@ -953,22 +1841,15 @@ void Render::createIndexBuffer()
     m_uIndexBuffer = m_device->createBufferUnique(
             vk::BufferCreateInfo({}, bufferSize,
                                  vk::BufferUsageFlagBits::eIndexBuffer));
-    vk::MemoryRequirements memRequirements =
-        m_device->getBufferMemoryRequirements(*m_uIndexBuffer);
+    m_uIndexBufferMemory = allocateMemory(
+            m_device->getBufferMemoryRequirements(*m_uIndexBuffer),
+            vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
 
-    uint32_t memoryTypeIndex =
-        findMemoryType(memRequirements.memoryTypeBits,
-                       vk::MemoryPropertyFlagBits::eHostVisible |
-                       vk::MemoryPropertyFlagBits::eHostCoherent);
-    m_uIndexBufferMemory = m_device->allocateMemoryUnique(
-            vk::MemoryAllocateInfo(memRequirements.size, memoryTypeIndex));
+    memcpy(m_uIndexBufferMemory.map(), indices.data(), bufferSize);
 
-    void *data = m_device->mapMemory(*m_uIndexBufferMemory, 0,
-                                     memRequirements.size);
-    memcpy(data, indices.data(), bufferSize);
-    m_device->unmapMemory(*m_uIndexBufferMemory);
-
-    m_device->bindBufferMemory(*m_uIndexBuffer, *m_uIndexBufferMemory, 0);
+    m_device->bindBufferMemory(*m_uIndexBuffer, m_uIndexBufferMemory.memory(),
+                               m_uIndexBufferMemory.offset());
 }
 
 uint32_t Render::findMemoryType(uint32_t typeFilter,
@@ -988,73 +1869,80 @@ uint32_t Render::findMemoryType(uint32_t typeFilter,
     throw std::runtime_error("findMemoryType failed");
 }
 
-void Render::createUniformBuffers()
+MemoryAllocator::Allocation
+Render::allocateMemory(const vk::MemoryRequirements &requirements,
+                       vk::MemoryPropertyFlags properties)
 {
-    uint32_t bufferSize = sizeof(UniformBufferObject);
-
-    m_uniformBuffers.resize(m_swapChainImages.size());
-    m_uniformBuffersMemory.resize(m_swapChainImages.size());
-
-    for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-        m_uniformBuffers.at(i) = m_device->createBufferUnique(
-                vk::BufferCreateInfo({}, bufferSize,
-                                     vk::BufferUsageFlagBits::eUniformBuffer));
-        vk::MemoryRequirements memRequirements =
-            m_device->getBufferMemoryRequirements(*m_uniformBuffers.at(i));
-
-        uint32_t memoryTypeIndex =
-            findMemoryType(memRequirements.memoryTypeBits,
-                           vk::MemoryPropertyFlagBits::eHostVisible |
-                           vk::MemoryPropertyFlagBits::eHostCoherent);
-        m_uniformBuffersMemory.at(i) = m_device->allocateMemoryUnique(
-                vk::MemoryAllocateInfo(memRequirements.size, memoryTypeIndex));
-
-        m_device->bindBufferMemory(*m_uniformBuffers.at(i),
-                                   *m_uniformBuffersMemory.at(i), 0);
-    }
+    return m_allocator->allocate(requirements,
+            findMemoryType(requirements.memoryTypeBits, properties));
 }
 
-void Render::updateUniformBuffer(uint32_t currentImage)
+// one slot per frame in flight, written through the allocator's mapping
+void Render::createUniformBuffers()
 {
-    static auto startTime = std::chrono::high_resolution_clock::now();
-
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>
-                    (currentTime - startTime).count();
+    vk::DeviceSize alignment = m_physicalDevice.getProperties()
+                                   .limits.minUniformBufferOffsetAlignment;
+    m_uniformStride = (sizeof(UniformBufferObject) + alignment - 1) /
+                      alignment * alignment;
+
+    m_uniformBuffer = m_device->createBufferUnique(
+            vk::BufferCreateInfo({}, m_uniformStride * MAX_FRAMES_IN_FLIGHT,
+                                 vk::BufferUsageFlagBits::eUniformBuffer));
+    m_uniformMemory = allocateMemory(
+            m_device->getBufferMemoryRequirements(*m_uniformBuffer),
+            vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_device->bindBufferMemory(*m_uniformBuffer, m_uniformMemory.memory(),
+                               m_uniformMemory.offset());
+
+    // every slot is written before its first use
+    m_uniformVersions.assign(MAX_FRAMES_IN_FLIGHT, 0);
+}
 
-    UniformBufferObject ubo = {};
-    ubo.model = glm::rotate(glm::mat4(1.0f),
-                            time * glm::radians(90.0f),
-                            glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f),
-                           glm::vec3(0.0f, 0.0f, 0.0f),
-                           glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.proj = glm::perspective(glm::radians(45.0f),
-                                m_swapChainExtent.width /
-                                    (float)m_swapChainExtent.height,
-                                0.001f, 256.0f);
-    ubo.proj[1][1] *= -1;
+// the layers follow the newest upload of each camera, the slot of frame is
+// only written if anything changed since it last was
+void Render::updateUniformBuffer(size_t frame)
+{
+    const std::vector<Layout::Tile> &tiles = m_layout.tiles();
+    for (size_t i = 0; i < tiles.size(); i++) {
+        uint32_t camera = tiles[i].camera;
+
+        int layer;
+        if (!m_config.dmaBuf) {
+            layer = camera * TEXTURE_SLOTS + m_textureSlots[camera];
+        } else if (m_currentSlots[camera] != -1) {
+            layer = m_dmaBufBase[camera] + m_currentSlots[camera];
+        } else {
+            layer = -1;
+        }
 
-    ubo.model = glm::mat4(1.0f);
-    ubo.view = glm::mat4(1.0f);
-    ubo.proj = glm::mat4(1.0f);
+        int &current = m_uniforms.layers[i / 4][i % 4];
+        if (current != layer) {
+            current = layer;
+            m_uniformsVersion++;
+        }
+    }
 
-    void *data = m_device->mapMemory(*m_uniformBuffersMemory.at(currentImage),
-                                     0, sizeof(ubo));
-    memcpy(data, &ubo, sizeof(ubo));
-    m_device->unmapMemory(*m_uniformBuffersMemory.at(currentImage));
+    uint64_t &version = m_uniformVersions.at(frame);
+    if (version == m_uniformsVersion) {
+        return;
+    }
+    memcpy(static_cast<char *>(m_uniformMemory.map()) +
+               m_uniformStride * frame,
+           &m_uniforms, sizeof(m_uniforms));
+    version = m_uniformsVersion;
 }
 
 void Render::createDescriptorPool()
 {
-    uint32_t descriptCnt = static_cast<uint32_t>(m_swapChainImages.size());
-    descriptCnt *= 4;
+    uint32_t descriptCnt = MAX_FRAMES_IN_FLIGHT * 4;
 
     std::array<vk::DescriptorPoolSize, 2> poolSizes = {
         vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer,
                                descriptCnt),
         vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler,
-                               descriptCnt)};
+                               descriptCnt * (textureCount() + 1) *
+                        m_ycbcrDescriptorCount)};
 
     m_descriptorPool = m_device->createDescriptorPoolUnique(
             vk::DescriptorPoolCreateInfo(
@@ -1064,42 +1952,73 @@ void Render::createDescriptorPool()
 
 void Render::createDescriptorSets()
 {
-    std::vector<vk::DescriptorSetLayout> layouts(m_swapChainImages.size(),
+    std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
                                                  *m_descriptorSetLayout);
 
     m_descriptorSets = m_device->allocateDescriptorSetsUnique(
-            vk::DescriptorSetAllocateInfo(
-                *m_descriptorPool,
-                static_cast<uint32_t>(m_swapChainImages.size()),
-                layouts.data()));
+            vk::DescriptorSetAllocateInfo(*m_descriptorPool,
+                                          MAX_FRAMES_IN_FLIGHT,
+                                          layouts.data()));
 
-    for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-        vk::DescriptorBufferInfo bufferInfo(*m_uniformBuffers.at(i),
-                0, sizeof(UniformBufferObject));
-
-        vk::DescriptorImageInfo
-            imageInfo(*m_utextureSampler, *m_utextureImageView,
-                    vk::ImageLayout::eShaderReadOnlyOptimal);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vk::DescriptorBufferInfo bufferInfo(*m_uniformBuffer,
+                m_uniformStride * i, sizeof(UniformBufferObject));
+
+        std::vector<vk::DescriptorImageInfo> imageInfos;
+        if (m_config.dmaBuf) {
+            for (const auto &imageView : m_dmaBufImageViews) {
+                imageInfos.push_back(vk::DescriptorImageInfo(
+                        *m_utextureSampler, *imageView,
+                        vk::ImageLayout::eGeneral));
+            }
+        } else {
+            imageInfos.push_back(vk::DescriptorImageInfo(
+                    *m_utextureSampler, *m_utextureImageView,
+                    vk::ImageLayout::eShaderReadOnlyOptimal));
+        }
 
-        std::array<vk::WriteDescriptorSet, 2> descriptorWrites = {
+        std::vector<vk::WriteDescriptorSet> descriptorWrites = {
             vk::WriteDescriptorSet(*m_descriptorSets.at(i), 0, 0, 1,
                     vk::DescriptorType::eUniformBuffer,
                     nullptr, &bufferInfo),
-            vk::WriteDescriptorSet(*m_descriptorSets.at(i), 1, 0, 1,
+            vk::WriteDescriptorSet(*m_descriptorSets.at(i), 1, 0,
+                    static_cast<uint32_t>(imageInfos.size()),
                     vk::DescriptorType::eCombinedImageSampler,
-                    &imageInfo, nullptr) };
+                    imageInfos.data(), nullptr) };
+
+        // shader.frag always reads binding 2, dmabuf.frag never does
+        vk::DescriptorImageInfo chromaInfo;
+        if (!m_config.dmaBuf) {
+            chromaInfo = vk::DescriptorImageInfo(*m_utextureSampler,
+                    m_uchromaImageView ? *m_uchromaImageView :
+                                         *m_utextureImageView,
+                    vk::ImageLayout::eShaderReadOnlyOptimal);
+            descriptorWrites.push_back(
+                vk::WriteDescriptorSet(*m_descriptorSets.at(i), 2, 0, 1,
+                        vk::DescriptorType::eCombinedImageSampler,
+                        &chromaInfo, nullptr));
+        }
         m_device->updateDescriptorSets(descriptorWrites, {});
     }
 }
 
 void Render::createCommandBuffers(int index)
 {
+    size_t imageCount = m_swapChainFramebuffers.size();
     m_commandBuffers = m_device->allocateCommandBuffersUnique(
             vk::CommandBufferAllocateInfo(*m_commandPool,
                                           vk::CommandBufferLevel::ePrimary,
-                                          (uint32_t)m_swapChainFramebuffers.size()));
+                                          (uint32_t)(MAX_FRAMES_IN_FLIGHT *
+                                                     imageCount)));
+
+    vk::Viewport viewport(0.0f, 0.0f, (float)m_swapChainExtent.width,
+                          (float)m_swapChainExtent.height, 0.0f, 1.0f);
+    vk::Rect2D scissor(vk::Offset2D(), m_swapChainExtent);
 
     for (size_t i = 0; i < m_commandBuffers.size(); i++) {
+        size_t frame = i / imageCount;
+        size_t image = i % imageCount;
+
         m_commandBuffers.at(i)->begin(
             vk::CommandBufferBeginInfo(
                 vk::CommandBufferUsageFlagBits::eSimultaneousUse));
@@ -1109,13 +2028,15 @@ void Render::createCommandBuffers(int index)
                     std::array<float, 4>({0.0f, 0.0f, 0.0f, 1.0f})));
         m_commandBuffers.at(i)->beginRenderPass(
             vk::RenderPassBeginInfo(*m_renderPass,
-                                    *m_swapChainFramebuffers.at(i),
+                                    *m_swapChainFramebuffers.at(image),
                                     vk::Rect2D(vk::Offset2D(0, 0),
                                                m_swapChainExtent),
                                     1, &clearColor),
             vk::SubpassContents::eInline);
         m_commandBuffers.at(i)->bindPipeline(vk::PipelineBindPoint::eGraphics,
                                              *m_graphicsPipeline);
+        m_commandBuffers.at(i)->setViewport(0, viewport);
+        m_commandBuffers.at(i)->setScissor(0, scissor);
 
         vk::DeviceSize offset = 0;
         m_commandBuffers.at(i)->bindVertexBuffers(0, *m_uVertexBuffer, offset);
@@ -1123,11 +2044,17 @@ void Render::createCommandBuffers(int index)
                                                 vk::IndexType::eUint16);
         m_commandBuffers.at(i)->bindDescriptorSets(
                 vk::PipelineBindPoint::eGraphics, *m_pipelineLayout, 0, 1,
-                &*m_descriptorSets.at(i), 0, nullptr);
-
-        for (int j = 0; j < 4; j++) {
-            m_commandBuffers.at(i)->drawIndexed(4, 1, 0,
-                    j * 4, j);
+                &*m_descriptorSets.at(frame), 0, nullptr);
+
+        // unused tiles have an empty rect and produce no fragments.
+        // dmabuf.frag picks its sampler by tile, an index only allowed to
+        // vary between draws, so there every tile is a draw of its own
+        if (m_config.dmaBuf) {
+            for (uint32_t tile = 0; tile < MAX_TILES; tile++) {
+                m_commandBuffers.at(i)->drawIndexed(4, 1, 0, 0, tile);
+            }
+        } else {
+            m_commandBuffers.at(i)->drawIndexed(4, MAX_TILES, 0, 0, 0);
         }
 
         m_commandBuffers.at(i)->endRenderPass();
@@ -1135,6 +2062,423 @@ void Render::createCommandBuffers(int index)
     }
 }
 
+// every upload there can be is one camera's staging slot into its layer,
+// so they are all recorded here and render() only picks them
+void Render::createUploadCommandBuffers()
+{
+    // upper bounds, render() never grows them
+    m_uploadSubmit.reserve(cameraCount() + TIMESTAMP_POINTS);
+    m_drawSubmit.reserve(cameraCount() + 2 + TIMESTAMP_POINTS);
+
+    if (m_config.dmaBuf) {
+        return;
+    }
+
+    m_uploadCommandBuffers.clear();
+    for (uint32_t i = 0; i < cameraCount(); i++) {
+        m_uploadCommandBuffers.push_back(
+            m_device->allocateCommandBuffersUnique(
+                vk::CommandBufferAllocateInfo(m_dedicatedTransfer ?
+                                                  *m_transferCommandPool :
+                                                  *m_commandPool,
+                                              vk::CommandBufferLevel::ePrimary,
+                                              m_config.bufferNum *
+                                                  TEXTURE_SLOTS)));
+        for (uint32_t j = 0; j < m_config.bufferNum; j++) {
+            for (uint32_t k = 0; k < TEXTURE_SLOTS; k++) {
+                recordUploadCommandBuffer(
+                    *m_uploadCommandBuffers[i][j * TEXTURE_SLOTS + k],
+                    i, j, i * TEXTURE_SLOTS + k);
+            }
+        }
+    }
+
+    if (!m_dedicatedTransfer) {
+        return;
+    }
+
+    // the acquire only depends on the layer, not on the staging slot
+    m_acquireCommandBuffers = m_device->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(*m_commandPool,
+                                          vk::CommandBufferLevel::ePrimary,
+                                          textureLayerCount()));
+    for (uint32_t i = 0; i < textureLayerCount(); i++) {
+        vk::CommandBuffer cmd = *m_acquireCommandBuffers[i];
+        cmd.begin(vk::CommandBufferBeginInfo());
+        for (vk::Image image : {*m_utextureImage, *m_uchromaImage}) {
+            if (!image) {
+                continue;
+            }
+            recordImageBarrier(cmd, image,
+                               vk::ImageLayout::eTransferDstOptimal,
+                               vk::ImageLayout::eShaderReadOnlyOptimal,
+                               vk::PipelineStageFlagBits::eTopOfPipe,
+                               vk::PipelineStageFlagBits::eFragmentShader,
+                               i, 1, m_transferFamily, m_graphicsFamily);
+        }
+        cmd.end();
+    }
+}
+
+// one buffer split into readbackDepth slots of the initial window size; a
+// window grown beyond that is not read back
+void Render::createReadbackBuffers()
+{
+    if (!m_config.readbackDepth) {
+        return;
+    }
+
+    m_readbackSlotSize =
+        m_swapChainExtent.width * m_swapChainExtent.height * 4;
+    vk::DeviceSize size = m_readbackSlotSize * m_config.readbackDepth;
+
+    m_readbackBuffer = m_device->createBufferUnique(
+            vk::BufferCreateInfo({}, size,
+                                 vk::BufferUsageFlagBits::eTransferDst));
+    vk::MemoryRequirements memRequirements =
+        m_device->getBufferMemoryRequirements(*m_readbackBuffer);
+
+    // the CPU reads every byte, uncached memory would crawl
+    uint32_t memoryTypeIndex;
+    try {
+        memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCached);
+    } catch (const std::runtime_error &) {
+        memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+    m_readbackMem = m_allocator->allocate(memRequirements, memoryTypeIndex);
+    m_device->bindBufferMemory(*m_readbackBuffer, m_readbackMem.memory(),
+                               m_readbackMem.offset());
+    m_readbackMap = static_cast<char *>(m_readbackMem.map());
+
+    m_readbackBusy = std::vector<std::atomic<bool>>(m_config.readbackDepth);
+    for (auto &busy : m_readbackBusy) {
+        busy.store(false);
+    }
+    m_inFlightReadbacks.assign(MAX_FRAMES_IN_FLIGHT, -1);
+    m_inFlightFrameNumbers.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    m_inFlightReadbackExtents.assign(MAX_FRAMES_IN_FLIGHT, vk::Extent2D());
+    m_readbackCommandBuffers = m_device->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(*m_commandPool,
+                                          vk::CommandBufferLevel::ePrimary,
+                                          MAX_FRAMES_IN_FLIGHT));
+}
+
+// copies the image just rendered into a free slot, false if there is none
+bool Render::recordReadback(size_t frame, uint32_t imageIndex)
+{
+    if (!m_config.readbackDepth) {
+        return false;
+    }
+
+    vk::DeviceSize frameBytes =
+        m_swapChainExtent.width * m_swapChainExtent.height * 4;
+    int slot = -1;
+    for (size_t i = 0; i < m_readbackBusy.size() && frameBytes <=
+            m_readbackSlotSize; i++) {
+        if (!m_readbackBusy[i].load(std::memory_order_acquire)) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        m_readbackSkipped++;
+        return false;
+    }
+    m_readbackBusy[slot].store(true, std::memory_order_relaxed);
+    m_inFlightReadbacks.at(frame) = slot;
+    m_inFlightFrameNumbers.at(frame) = m_frameNumber;
+    m_inFlightReadbackExtents.at(frame) = m_swapChainExtent;
+
+    vk::CommandBuffer cmd = *m_readbackCommandBuffers.at(frame);
+    cmd.reset({});
+    cmd.begin(vk::CommandBufferBeginInfo(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    // the render pass leaves the image for presentation (or already as a
+    // transfer source when headless), the draw's writes have to land first
+    vk::Image image = m_swapChainImages.at(imageIndex);
+    vk::ImageLayout finalLayout = m_config.headless ?
+        vk::ImageLayout::eTransferSrcOptimal :
+        vk::ImageLayout::ePresentSrcKHR;
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor,
+                                    0, 1, 0, 1);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                        vk::PipelineStageFlagBits::eTransfer, {}, nullptr,
+                        nullptr,
+                        vk::ImageMemoryBarrier(
+                            vk::AccessFlagBits::eColorAttachmentWrite,
+                            vk::AccessFlagBits::eTransferRead,
+                            finalLayout,
+                            vk::ImageLayout::eTransferSrcOptimal,
+                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                            image, range));
+
+    cmd.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal,
+                          *m_readbackBuffer,
+                          vk::BufferImageCopy(
+                              m_readbackSlotSize * slot, 0, 0,
+                              vk::ImageSubresourceLayers(
+                                  vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                              vk::Offset3D(0, 0, 0),
+                              vk::Extent3D(m_swapChainExtent.width,
+                                           m_swapChainExtent.height, 1)));
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr,
+                        nullptr,
+                        vk::ImageMemoryBarrier(
+                            vk::AccessFlagBits::eTransferRead, {},
+                            vk::ImageLayout::eTransferSrcOptimal,
+                            finalLayout,
+                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                            image, range));
+    // made visible to the host once the fence signals
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eHost, {},
+                        vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                          vk::AccessFlagBits::eHostRead),
+                        nullptr, nullptr);
+
+    cmd.end();
+
+    return true;
+}
+
+void Render::deliverReadback(size_t frame)
+{
+    if (m_inFlightReadbacks.empty() || m_inFlightReadbacks.at(frame) == -1) {
+        return;
+    }
+
+    int slot = m_inFlightReadbacks[frame];
+    m_inFlightReadbacks[frame] = -1;
+
+    vk::DeviceSize offset = m_readbackSlotSize * slot;
+    m_allocator->invalidate(m_readbackMem, offset, m_readbackSlotSize);
+
+    if (!m_readbackCallback) {
+        releaseReadback(slot);
+        return;
+    }
+
+    ReadbackFrame readback;
+    readback.slot = slot;
+    readback.data = m_readbackMap + offset;
+    readback.format = m_swapChainImageFormat;
+    readback.width = m_inFlightReadbackExtents.at(frame).width;
+    readback.height = m_inFlightReadbackExtents.at(frame).height;
+    readback.bytesPerLine = readback.width * 4;
+    readback.frameNumber = m_inFlightFrameNumbers.at(frame);
+    m_readbackCallback(readback);
+}
+
+void Render::createTimestampQueries()
+{
+    std::vector<vk::QueueFamilyProperties> families =
+        m_physicalDevice.getQueueFamilyProperties();
+    double period = m_physicalDevice.getProperties().limits.timestampPeriod;
+    auto mask = [](uint32_t validBits) {
+        return validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    };
+
+    uint32_t validBits = families.at(m_graphicsFamily).timestampValidBits;
+    if (validBits == 0) {
+        return;
+    }
+    m_timestampPeriod = period;
+    m_timestampMask = mask(validBits);
+    if (m_dedicatedTransfer) {
+        validBits = families.at(m_transferFamily).timestampValidBits;
+        m_transferTimestampPeriod = validBits ? period : 0.0;
+        m_transferTimestampMask = mask(validBits);
+    } else {
+        m_transferTimestampPeriod = m_timestampPeriod;
+        m_transferTimestampMask = m_timestampMask;
+    }
+
+    // two sets of UploadBegin and UploadEnd per frame in flight behind the
+    // graphics queue's queries
+    uint32_t graphicsQueries = MAX_FRAMES_IN_FLIGHT * TIMESTAMP_POINTS;
+    uint32_t transferQueries = MAX_FRAMES_IN_FLIGHT * 2 * 2;
+    m_timestampPool = m_device->createQueryPoolUnique(
+            vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp,
+                                    graphicsQueries + transferQueries));
+    m_inFlightTimestamps.assign(MAX_FRAMES_IN_FLIGHT, FrameTimestamps());
+
+    // bottom of pipe: written once everything submitted before it has
+    // finished, so a span is the GPU time of what it encloses
+    m_timestampCommandBuffers = m_device->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(*m_commandPool,
+                                          vk::CommandBufferLevel::ePrimary,
+                                          graphicsQueries));
+    for (uint32_t query = 0; query < graphicsQueries; query++) {
+        vk::CommandBuffer cmd = *m_timestampCommandBuffers[query];
+        cmd.begin(vk::CommandBufferBeginInfo());
+        cmd.resetQueryPool(*m_timestampPool, query, 1);
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                           *m_timestampPool, query);
+        cmd.end();
+    }
+
+    if (!m_dedicatedTransfer || m_transferTimestampPeriod == 0.0) {
+        return;
+    }
+
+    m_transferTimestampCommandBuffers = m_device->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(*m_transferCommandPool,
+                                          vk::CommandBufferLevel::ePrimary,
+                                          transferQueries));
+    m_transferResetCommandBuffers = m_device->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(*m_commandPool,
+                                          vk::CommandBufferLevel::ePrimary,
+                                          MAX_FRAMES_IN_FLIGHT * 2));
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (uint32_t set = 0; set < 2; set++) {
+            for (int point : {UploadBegin, UploadEnd}) {
+                vk::CommandBuffer cmd = *m_transferTimestampCommandBuffers[
+                    (i * 2 + set) * 2 + point];
+                cmd.begin(vk::CommandBufferBeginInfo());
+                cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   *m_timestampPool,
+                                   transferQuery(i, set, point));
+                cmd.end();
+            }
+
+            vk::CommandBuffer reset = *m_transferResetCommandBuffers[i * 2 +
+                                                                     set];
+            reset.begin(vk::CommandBufferBeginInfo());
+            reset.resetQueryPool(*m_timestampPool,
+                                 transferQuery(i, set, UploadBegin), 2);
+            reset.end();
+        }
+    }
+    m_transferQuerySets.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+    // every set has to be reset once before its first write
+    std::vector<vk::CommandBuffer> resets;
+    for (const auto &reset : m_transferResetCommandBuffers) {
+        resets.push_back(*reset);
+    }
+    m_graphicsQueue.submit(vk::SubmitInfo(0, nullptr, nullptr,
+                                          resets.size(), resets.data()), {});
+    m_graphicsQueue.waitIdle();
+}
+
+uint32_t Render::transferQuery(size_t frame, uint32_t set, int point)
+{
+    return MAX_FRAMES_IN_FLIGHT * TIMESTAMP_POINTS + (frame * 2 + set) * 2 +
+           point;
+}
+
+// puts the timestamp points between what render() is about to submit:
+// m_drawSubmit is the uploads or acquires, the draw and maybe the readback
+void Render::queueTimestamps(size_t frame, bool readback)
+{
+    FrameTimestamps &timestamps = m_inFlightTimestamps.at(frame);
+    timestamps = FrameTimestamps();
+    auto insert = [&](std::vector<vk::CommandBuffer> &submit,
+                      size_t position, TimestampPoint point) {
+        submit.insert(submit.begin() + position,
+                      *m_timestampCommandBuffers.at(
+                          frame * TIMESTAMP_POINTS + point));
+        timestamps.points |= 1u << point;
+    };
+
+    // back to front, so the positions before stay valid
+    size_t uploads = m_drawSubmit.size() - (readback ? 2 : 1);
+    if (readback) {
+        insert(m_drawSubmit, m_drawSubmit.size(), ReadbackEnd);
+    }
+    insert(m_drawSubmit, uploads + 1, DrawEnd);
+    insert(m_drawSubmit, uploads, DrawBegin);
+    if (uploads == 0) {
+        return;
+    }
+    timestamps.uploads = uploads;
+    if (m_dedicatedTransfer) {
+        insert(m_drawSubmit, 0, AcquireBegin);
+        if (!m_transferTimestampCommandBuffers.empty()) {
+            uint32_t &set = m_transferQuerySets.at(frame);
+            m_uploadSubmit.insert(m_uploadSubmit.begin(),
+                                  *m_transferTimestampCommandBuffers.at(
+                                      (frame * 2 + set) * 2 + UploadBegin));
+            m_uploadSubmit.push_back(*m_transferTimestampCommandBuffers.at(
+                                         (frame * 2 + set) * 2 + UploadEnd));
+            m_drawSubmit.insert(m_drawSubmit.begin(),
+                                *m_transferResetCommandBuffers.at(
+                                    frame * 2 + (set ^ 1)));
+            timestamps.points |= (1u << UploadBegin) | (1u << UploadEnd);
+            timestamps.transferSet = set;
+            set ^= 1;
+        }
+    } else {
+        insert(m_drawSubmit, uploads, UploadEnd);
+        insert(m_drawSubmit, 0, UploadBegin);
+    }
+}
+
+// the frame's fence has signalled, so every query it wrote is available
+void Render::resolveTimestamps(size_t frame)
+{
+    if (m_inFlightTimestamps.empty() ||
+        m_inFlightTimestamps.at(frame).points == 0) {
+        return;
+    }
+    FrameTimestamps timestamps = m_inFlightTimestamps[frame];
+    m_inFlightTimestamps[frame] = FrameTimestamps();
+
+    // queries of points not written this frame may never have been reset
+    std::array<uint64_t, TIMESTAMP_POINTS> ticks = {};
+    for (int point = 0; point < TIMESTAMP_POINTS; point++) {
+        if (!(timestamps.points & (1u << point))) {
+            continue;
+        }
+        bool transfer = m_dedicatedTransfer &&
+            (point == UploadBegin || point == UploadEnd);
+        uint32_t query = transfer ?
+            transferQuery(frame, timestamps.transferSet, point) :
+            frame * TIMESTAMP_POINTS + point;
+        if (m_device->getQueryPoolResults(
+                *m_timestampPool, query, 1,
+                sizeof(uint64_t), &ticks[point], sizeof(uint64_t),
+                vk::QueryResultFlagBits::e64) != vk::Result::eSuccess) {
+            return;
+        }
+    }
+
+    auto span = [&](TimestampPoint begin, TimestampPoint end, bool transfer) {
+        uint64_t mask = transfer ? m_transferTimestampMask : m_timestampMask;
+        double period = transfer ? m_transferTimestampPeriod :
+                                   m_timestampPeriod;
+        return static_cast<uint64_t>(((ticks[end] - ticks[begin]) & mask) *
+                                     period);
+    };
+    uint32_t written = timestamps.points;
+    auto has = [written](TimestampPoint point) {
+        return (written & (1u << point)) != 0;
+    };
+
+    if (has(UploadBegin)) {
+        uint64_t upload = span(UploadBegin, UploadEnd, m_dedicatedTransfer);
+        m_gpuStats.record(GpuStats::Upload, upload);
+        m_gpuStats.record(GpuStats::UploadPerCamera,
+                          upload / timestamps.uploads);
+    }
+    if (has(AcquireBegin)) {
+        m_gpuStats.record(GpuStats::Acquire,
+                          span(AcquireBegin, DrawBegin, false));
+    }
+    m_gpuStats.record(GpuStats::Draw, span(DrawBegin, DrawEnd, false));
+    if (has(ReadbackEnd)) {
+        m_gpuStats.record(GpuStats::Readback,
+                          span(DrawEnd, ReadbackEnd, false));
+    }
+}
+
 void Render::createSyncObjects()
 {
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
@@ -1147,6 +2491,11 @@ void Render::createSyncObjects()
         m_inFlightFences.push_back(
             m_device->createFenceUnique(
                 vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled)));
+
+        if (m_dedicatedTransfer) {
+            m_uploadDoneSemaphores.push_back(
+                m_device->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
+        }
     }
 }
 
@@ -1157,34 +2506,19 @@ void Render::framebufferResizeCallback(GLFWwindow *window,
     app->setFbResized();
 }
 
-void Render::cleanupSwapChain()
+void Render::keyCallback(GLFWwindow *window, int key, int scancode,
+                         int action, int mods)
 {
-    for (auto &framebuffer : m_swapChainFramebuffers) {
-        m_device->destroyFramebuffer(*framebuffer);
-    }
-
-    for (auto &commandBuffer : m_commandBuffers) {
-        commandBuffer.reset();
-    }
-
-    m_device->destroyPipeline(*m_graphicsPipeline);
-    m_device->destroyPipelineLayout(*m_pipelineLayout);
-    m_device->destroyRenderPass(*m_renderPass);
-
-    for (auto &imageView : m_swapChainImageViews) {
-        m_device->destroyImageView(*imageView);
-    }
-
-    m_device->destroySwapchainKHR(*m_swapChain);
-
-    for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-        m_uniformBuffers.at(i).reset();
-        m_uniformBuffersMemory.at(i).reset();
+    auto app = reinterpret_cast<Render*>(glfwGetWindowUserPointer(window));
+    if (action == GLFW_PRESS && app->m_keyCallback) {
+        app->m_keyCallback(key);
     }
-
-    m_descriptorPool.reset();
 }
 
+// only what depends on the swapchain images is replaced, without waiting
+// for the GPU: the old swapchain goes in as oldSwapchain and is destroyed
+// together with its views, framebuffers and command buffers once the frames
+// using them have retired
 void Render::recreateSwapChain(int index)
 {
     int width = 0, height = 0;
@@ -1193,18 +2527,38 @@ void Render::recreateSwapChain(int index)
         glfwWaitEvents();
     }
 
-    m_device->waitIdle();
-
-    cleanupSwapChain();
+    RetiredSwapChain retired;
+    retired.swapChain = std::move(m_swapChain);
+    retired.imageViews = std::move(m_swapChainImageViews);
+    retired.framebuffers = std::move(m_swapChainFramebuffers);
+    retired.commandBuffers = std::move(m_commandBuffers);
+    retired.frames = MAX_FRAMES_IN_FLIGHT;
+    m_retiredSwapChains.push_back(std::move(retired));
 
-    createSwapChain();
+    vk::Format format = m_swapChainImageFormat;
+    createSwapChain(*m_retiredSwapChains.back().swapChain);
     createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
+    if (m_swapChainImageFormat != format) {
+        // the render pass and so the pipeline are tied to the format, a
+        // change of it is rare enough to wait for
+        m_device->waitIdle();
+        m_retiredSwapChains.clear();
+        createRenderPass();
+        createGraphicsPipeline();
+    }
     createFramebuffers();
-    createUniformBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
     createCommandBuffers(index);
 }
 
+// once per submit: each one has waited for another frame in flight
+void Render::destroyRetiredSwapChains()
+{
+    for (auto it = m_retiredSwapChains.begin();
+         it != m_retiredSwapChains.end();) {
+        if (--it->frames == 0) {
+            it = m_retiredSwapChains.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -3,14 +3,36 @@
 #include <GLFW/glfw3.h>
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
+#include <linux/videodev2.h>
 #include <vector>
 #include <string>
 #include <array>
+#include <functional>
+#include <utility>
 #include <cstddef>
+#include <atomic>
+#include <memory>
+
+#include "frame.hpp"
+#include "gpustats.hpp"
+#include "layout.hpp"
+#include "latencystats.hpp"
+#include "memoryallocator.hpp"
+#include "streamstats.hpp"
 
 class Render
 {
 public:
+    static const uint32_t MAX_CAMERAS = 16;
+    // tiles of a layout, all of them are drawn as instances of one quad
+    static const uint32_t MAX_TILES = 16;
+    static const int MAX_FRAMES_IN_FLIGHT = 2;
+    // texture layers per camera, one per frame in flight: render() waits
+    // for the fence of the frame it reuses, so only the other frames in
+    // flight may still sample a layer and one is always free to upload into
+    static const uint32_t TEXTURE_SLOTS = MAX_FRAMES_IN_FLIGHT;
+
+    // corner of the unit quad every tile is placed from
     struct Vertex
     {
         glm::vec2 pos;
@@ -46,16 +68,141 @@ public:
         alignas(16) glm::mat4 model;
         alignas(16) glm::mat4 view;
         alignas(16) glm::mat4 proj;
+        // per tile: x, y, width, height in clip space, empty if unused
+        alignas(16) glm::vec4 rects[MAX_TILES];
+        // per tile: texture layer (array mode) or image index (dmabuf) of
+        // its camera, four to an ivec4 as std140 pads int arrays
+        alignas(16) glm::ivec4 layers[MAX_TILES / 4];
+    };
+
+    // dmabuf fds of one camera, e.g. from V4l2Capture::exportBuffers()
+    struct DmaBufImport
+    {
+        std::vector<int> fds;
+        uint32_t bytesPerLine = 0;
+    };
+
+    struct Config
+    {
+        uint32_t imageWidth = 1280;
+        uint32_t imageHeight = 800;
+        // V4L2 fourcc: XBGR32, YUYV, UYVY, NV12 or NV12M, YUV is converted on
+        // the GPU, NV12 by a sampler YCbCr conversion where supported
+        uint32_t pixelFormat = V4L2_PIX_FMT_XBGR32;
+        // staging path: cameras and staging slots per camera, the dmabuf
+        // path takes both from dmaBufs
+        uint32_t cameraNum = 4;
+        uint32_t bufferNum = 4;
+        // no window or swapchain, the mosaic is rendered into offscreen
+        // images of outputWidth x outputHeight
+        bool headless = false;
+        uint32_t outputWidth = 800;
+        uint32_t outputHeight = 600;
+        // host buffers the rendered frames are copied into, 0 for none
+        uint32_t readbackDepth = 0;
+        // VkPipelineCache kept between runs, empty for none
+        std::string pipelineCache = "pipeline.cache";
+        // sample the capture buffers directly instead of a staging copy
+        bool dmaBuf = false;
+        std::vector<DmaBufImport> dmaBufs;
+    };
+
+    // called once the GPU no longer reads staging slot (index, subIndex)
+    using ReleaseCallback = std::function<void(int index, int subIndex)>;
+    // GLFW key code of a key pressed in the window
+    using KeyCallback = std::function<void(int key)>;
+
+    // one rendered frame in a readback slot, tightly packed 4 byte pixels
+    struct ReadbackFrame
+    {
+        int slot;
+        const void *data;
+        // the swapchain (usually B8G8R8A8) or offscreen (R8G8B8A8) format
+        vk::Format format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytesPerLine;
+        // counts every render() since init
+        uint64_t frameNumber;
     };
+    // runs on the render thread once the GPU wrote a frame; frame.data stays
+    // valid until releaseReadback(frame.slot) which may come from any thread
+    using ReadbackCallback = std::function<void(const ReadbackFrame &frame)>;
 
-    void init();
-    void updateTexture(int index, int subIndex);
-    void getBufferAddrs(int index, std::array<void *, 4> &bufferMaps);
+    void init(const Config &config = Config());
+    void setReleaseCallback(const ReleaseCallback &callback)
+    {
+        m_releaseCallback = callback;
+    }
+    void setKeyCallback(const KeyCallback &callback)
+    {
+        m_keyCallback = callback;
+    }
+    void setReadbackCallback(const ReadbackCallback &callback)
+    {
+        m_readbackCallback = callback;
+    }
+    void releaseReadback(int slot)
+    {
+        m_readbackBusy.at(slot).store(false, std::memory_order_release);
+    }
+    // frames not read back because every slot was still busy
+    uint64_t readbackSkipped() const
+    {
+        return m_readbackSkipped;
+    }
+    // takes effect with the next frame, only the uniform buffer changes;
+    // grid of all cameras after init()
+    void setLayout(const Layout &layout);
+    // per camera, counts displayed and superseded frames
+    void setStreamStats(const std::vector<StreamStats *> &stats)
+    {
+        m_streamStats = stats;
+    }
+    // frame.index is the staging slot (or dmabuf) of camera index
+    void updateTexture(int index, const Frame &frame);
+    void getBufferAddrs(int index, std::vector<void *> &bufferMaps);
+    // bytes of one staging slot
+    vk::DeviceSize frameSize();
     void render(int index);
+    LatencyStats &latencyStats()
+    {
+        return m_latencyStats;
+    }
+    // timestamp queries around the uploads, the draw and the readback of
+    // every frame, resolved once it retires; nothing is written while off.
+    // Stays off if the graphics queue has no timestamps.
+    void setGpuProfiling(bool enable)
+    {
+        m_gpuProfiling = enable && m_timestampPool;
+    }
+    bool gpuProfiling() const
+    {
+        return m_gpuProfiling;
+    }
+    GpuStats &gpuStats()
+    {
+        return m_gpuStats;
+    }
+    const MemoryAllocator &memoryAllocator() const
+    {
+        return *m_allocator;
+    }
     bool checkValidationLayerSupport();
     bool shouldStop()
     {
-        return !glfwWindowShouldClose(m_window);
+        return m_config.headless || !glfwWindowShouldClose(m_window);
+    }
+    bool headless() const
+    {
+        return m_config.headless;
+    }
+    // window events, nothing to do headless
+    void pollEvents()
+    {
+        if (!m_config.headless) {
+            glfwPollEvents();
+        }
     }
     void setFbResized()
     {
@@ -72,52 +219,186 @@ public:
 private:
     static const std::vector<const char *> validationLayers;
 
-    GLFWwindow *m_window;
+    Config m_config;
+    GLFWwindow *m_window = nullptr;
     vk::UniqueInstance m_instance;
     vk::UniqueDebugReportCallbackEXT m_debugCallback;
     vk::UniqueSurfaceKHR m_surface;
     vk::PhysicalDevice m_physicalDevice;
     vk::UniqueDevice m_device;
+    // everything but the imported dmabufs, declared before its allocations
+    std::unique_ptr<MemoryAllocator> m_allocator;
     vk::Queue m_graphicsQueue;
     vk::Queue m_presentQueue;
+    // uploads run here when the device has a transfer-only family,
+    // otherwise it is the graphics queue
+    vk::Queue m_transferQueue;
+    bool m_dedicatedTransfer = false;
+    uint32_t m_graphicsFamily = 0;
+    uint32_t m_transferFamily = 0;
     vk::UniqueSwapchainKHR m_swapChain;
     std::vector<vk::Image> m_swapChainImages;
     vk::Format m_swapChainImageFormat;
     vk::Extent2D m_swapChainExtent;
     std::vector<vk::UniqueImageView> m_swapChainImageViews;
     std::vector<vk::UniqueFramebuffer> m_swapChainFramebuffers;
+    // headless: the render targets behind m_swapChainImages
+    std::vector<vk::UniqueImage> m_offscreenImages;
+    std::vector<MemoryAllocator::Allocation> m_offscreenMems;
 
     vk::UniqueRenderPass m_renderPass;
     vk::UniqueDescriptorSetLayout m_descriptorSetLayout;
     vk::UniquePipelineLayout m_pipelineLayout;
+    vk::UniquePipelineCache m_pipelineCache;
+    // size of the cache data last written to m_config.pipelineCache
+    size_t m_pipelineCacheSaved = 0;
     vk::UniquePipeline m_graphicsPipeline;
 
     vk::UniqueCommandPool m_commandPool;
+    vk::UniqueCommandPool m_transferCommandPool;
 
     vk::UniqueImage m_utextureImage;
-    vk::UniqueDeviceMemory m_utextureMem;
+    MemoryAllocator::Allocation m_utextureMem;
     vk::UniqueImageView m_utextureImageView;
+    // NV12 CbCr plane, the luma plane is m_utextureImage
+    vk::UniqueImage m_uchromaImage;
+    MemoryAllocator::Allocation m_uchromaMem;
+    vk::UniqueImageView m_uchromaImageView;
     vk::UniqueSampler m_utextureSampler;
+    // NV12 sampled as G8_B8R8_2PLANE_420 through an immutable sampler
+    bool m_ycbcr = false;
+    uint32_t m_ycbcrDescriptorCount = 1;
+    vk::UniqueSamplerYcbcrConversion m_ycbcrConversion;
     vk::UniqueBuffer m_uStageBuffer;
-    vk::UniqueDeviceMemory m_uStageMem;
-    std::vector<std::array<void *, 4>> m_stageMemMaps;
+    MemoryAllocator::Allocation m_uStageMem;
+    std::vector<std::vector<void *>> m_stageMemMaps;
+    std::vector<vk::UniqueImage> m_dmaBufImages;
+    std::vector<vk::UniqueDeviceMemory> m_dmaBufMems;
+    std::vector<vk::UniqueImageView> m_dmaBufImageViews;
+    std::vector<uint32_t> m_dmaBufBase;
+    std::vector<int> m_currentSlots;
+
+    std::vector<Frame> m_pendingUploads;
+    std::vector<std::vector<int>> m_slotRefs;
+    std::vector<std::vector<std::pair<int, int>>> m_inFlightSlots;
+    // frames first shown by each frame in flight, for the latency stats
+    std::vector<std::vector<std::pair<int, Frame>>> m_inFlightFrames;
+    LatencyStats m_latencyStats;
+
+    // where the frame is split up for GpuStats, in submission order
+    enum TimestampPoint
+    {
+        UploadBegin,
+        UploadEnd,
+        AcquireBegin,
+        DrawBegin,
+        DrawEnd,
+        ReadbackEnd,
+        TIMESTAMP_POINTS
+    };
+    struct FrameTimestamps
+    {
+        // bit per TimestampPoint written
+        uint32_t points = 0;
+        uint32_t uploads = 0;
+        // dedicated transfer: query set the upload points went to
+        uint32_t transferSet = 0;
+    };
+    bool m_gpuProfiling = false;
+    vk::UniqueQueryPool m_timestampPool;
+    // [frame in flight * TIMESTAMP_POINTS + point], each resets and writes
+    // its query
+    std::vector<vk::UniqueCommandBuffer> m_timestampCommandBuffers;
+    // dedicated transfer: vkCmdResetQueryPool is not allowed there, so each
+    // frame in flight alternates between two sets of upload queries; the
+    // graphics submit writing to one resets the other, which was read when
+    // the frame last retired.
+    // [(frame in flight * 2 + set) * 2 + UploadBegin/UploadEnd]
+    std::vector<vk::UniqueCommandBuffer> m_transferTimestampCommandBuffers;
+    // [frame in flight * 2 + set], on the graphics queue
+    std::vector<vk::UniqueCommandBuffer> m_transferResetCommandBuffers;
+    // the set each frame in flight writes next
+    std::vector<uint32_t> m_transferQuerySets;
+    std::vector<FrameTimestamps> m_inFlightTimestamps;
+    // ns per tick, 0 if the transfer queue has no timestamps
+    double m_timestampPeriod = 0.0;
+    double m_transferTimestampPeriod = 0.0;
+    uint64_t m_timestampMask = 0;
+    uint64_t m_transferTimestampMask = 0;
+    GpuStats m_gpuStats;
+    std::vector<StreamStats *> m_streamStats;
+    ReleaseCallback m_releaseCallback;
+    KeyCallback m_keyCallback;
+    Layout m_layout;
 
     vk::UniqueBuffer m_uVertexBuffer;
-    vk::UniqueDeviceMemory m_uVertexBufferMem;
+    MemoryAllocator::Allocation m_uVertexBufferMem;
     vk::UniqueBuffer m_uIndexBuffer;
-    vk::UniqueDeviceMemory m_uIndexBufferMemory;
+    MemoryAllocator::Allocation m_uIndexBufferMemory;
 
-    std::vector<vk::UniqueBuffer> m_uniformBuffers;
-    std::vector<vk::UniqueDeviceMemory> m_uniformBuffersMemory;
+    vk::UniqueBuffer m_uniformBuffer;
+    MemoryAllocator::Allocation m_uniformMemory;
+    vk::DeviceSize m_uniformStride = 0;
+    // what the next frame shows, bumped on every change
+    UniformBufferObject m_uniforms = {};
+    uint64_t m_uniformsVersion = 1;
+    // version last written into the slot of each frame in flight
+    std::vector<uint64_t> m_uniformVersions;
 
     vk::UniqueDescriptorPool m_descriptorPool;
     std::vector<vk::UniqueDescriptorSet> m_descriptorSets;
 
+    // [frame in flight * swapchain images + image], so the descriptor set
+    // and uniform slot follow the frame and only these depend on the
+    // swapchain
     std::vector<vk::UniqueCommandBuffer> m_commandBuffers;
 
+    // what recreateSwapChain() replaced, kept until the frames in flight
+    // that may still use it have been waited for
+    struct RetiredSwapChain
+    {
+        vk::UniqueSwapchainKHR swapChain;
+        std::vector<vk::UniqueImageView> imageViews;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+        std::vector<vk::UniqueCommandBuffer> commandBuffers;
+        // submits left until it is destroyed
+        int frames;
+    };
+    std::vector<RetiredSwapChain> m_retiredSwapChains;
+
+    // recorded once, [camera][staging slot * TEXTURE_SLOTS + texture slot]
+    std::vector<std::vector<vk::UniqueCommandBuffer>> m_uploadCommandBuffers;
+    // dedicated transfer: graphics side of the ownership transfers, per
+    // texture layer
+    std::vector<vk::UniqueCommandBuffer> m_acquireCommandBuffers;
+    // texture slot with the newest upload of each camera, the one drawn
+    std::vector<uint32_t> m_textureSlots;
+    // m_textureSlots as sampled by each frame in flight
+    std::vector<std::vector<uint32_t>> m_inFlightTextures;
+    // what render() submits to the transfer and graphics queue
+    std::vector<vk::CommandBuffer> m_uploadSubmit;
+    std::vector<vk::CommandBuffer> m_drawSubmit;
+
+    vk::UniqueBuffer m_readbackBuffer;
+    MemoryAllocator::Allocation m_readbackMem;
+    char *m_readbackMap = nullptr;
+    vk::DeviceSize m_readbackSlotSize = 0;
+    std::vector<std::atomic<bool>> m_readbackBusy;
+    std::vector<vk::UniqueCommandBuffer> m_readbackCommandBuffers;
+    // slot written by each frame in flight, -1 if none
+    std::vector<int> m_inFlightReadbacks;
+    std::vector<uint64_t> m_inFlightFrameNumbers;
+    // the swapchain may be resized while a readback is in flight
+    std::vector<vk::Extent2D> m_inFlightReadbackExtents;
+    uint64_t m_frameNumber = 0;
+    uint64_t m_readbackSkipped = 0;
+    ReadbackCallback m_readbackCallback;
+
     std::vector<vk::UniqueSemaphore> m_imageAvailableSemaphores;
     std::vector<vk::UniqueSemaphore> m_renderFinishedSemaphores;
     std::vector<vk::UniqueFence> m_inFlightFences;
+    // dedicated transfer: uploads signal the draw of the same frame
+    std::vector<vk::UniqueSemaphore> m_uploadDoneSemaphores;
     size_t m_currentFrame = 0;
     bool framebufferResized = false;
 
@@ -136,6 +417,8 @@ private:
     struct QueueFamilyIndices {
         uint32_t graphicsFamily = -1;
         uint32_t presentFamily = -1;
+        // a family with transfer but neither graphics nor compute, -1 if none
+        uint32_t transferFamily = -1;
 
         bool isComplete()
         {
@@ -151,12 +434,15 @@ private:
     void createLogicalDevice();
 
     static const std::vector<const char *> deviceExtensions;
+    static const std::vector<const char *> dmaBufDeviceExtensions;
+    std::vector<const char *> m_deviceExtensions;
     struct SwapChainSupportDetails {
         vk::SurfaceCapabilitiesKHR capabilities;
         std::vector<vk::SurfaceFormatKHR> formats;
         std::vector<vk::PresentModeKHR> presentModes;
     };
-    void createSwapChain();
+    void createSwapChain(vk::SwapchainKHR oldSwapChain = nullptr);
+    void createOffscreenImages();
     SwapChainSupportDetails querySwapChainSupport(vk::PhysicalDevice device);
     vk::SurfaceFormatKHR chooseSwapSurfaceFormat(
             const std::vector<vk::SurfaceFormatKHR>& availableFormats);
@@ -170,9 +456,12 @@ private:
 
     void createDescriptorSetLayout();
 
+    void createPipelineCache();
+    void savePipelineCache();
     void createGraphicsPipeline();
     static std::vector<char> readFile(const std::string& filename);
-    vk::UniqueShaderModule createShaderModule(const std::vector<char>& code);
+    vk::UniqueShaderModule createShaderModule(const uint32_t *code,
+                                              size_t size);
 
     void createFramebuffers();
 
@@ -181,26 +470,78 @@ private:
     void transitionImageLayout(vk::Image image, vk::ImageLayout oldLayout,
                                vk::ImageLayout newLayout,
                                vk::PipelineStageFlags srcStageMask,
-                               vk::PipelineStageFlags dstStageMask);
+                               vk::PipelineStageFlags dstStageMask,
+                               uint32_t layerCount);
+    void recordImageBarrier(vk::CommandBuffer cmd, vk::Image image,
+                            vk::ImageLayout oldLayout,
+                            vk::ImageLayout newLayout,
+                            vk::PipelineStageFlags srcStageMask,
+                            vk::PipelineStageFlags dstStageMask,
+                            uint32_t baseLayer, uint32_t layerCount,
+                            uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+                            uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
     void createTextureImage();
+    void createTextureArray(vk::Format format, vk::Extent2D extent,
+                            vk::UniqueImage &image,
+                            MemoryAllocator::Allocation &memory);
     void createTextureImageView();
+    vk::Format textureFormat();
+    vk::Extent2D textureExtent();
+    vk::Extent2D chromaExtent();
+    uint32_t shaderFormat();
+    bool isNv12();
+    bool checkYcbcrSupport();
     void createTextureSampler();
+    void importDmaBufs();
+    void initSlots();
+    uint32_t cameraCount();
+    uint32_t textureLayerCount();
+    uint32_t textureCount();
 
     uint32_t findMemoryType(uint32_t typeFilter,
                             vk::MemoryPropertyFlags properties);
+    MemoryAllocator::Allocation
+        allocateMemory(const vk::MemoryRequirements &requirements,
+                       vk::MemoryPropertyFlags properties);
 
     void createVertexBuffer();
     void createIndexBuffer();
     void createUniformBuffers();
-    void updateUniformBuffer(uint32_t currentImage);
+    void updateUniformBuffer(size_t frame);
     void createDescriptorPool();
     void createDescriptorSets();
     void createCommandBuffers(int index);
+    void createUploadCommandBuffers();
+    void createReadbackBuffers();
+    void createTimestampQueries();
+    uint32_t transferQuery(size_t frame, uint32_t set, int point);
+    void queueTimestamps(size_t frame, bool readback);
+    void resolveTimestamps(size_t frame);
+    bool recordReadback(size_t frame, uint32_t imageIndex);
+    void deliverReadback(size_t frame);
+    bool queueUploads(size_t frame);
+    uint32_t freeTextureSlot(size_t frame, uint32_t index);
+    void recordUploadCommandBuffer(vk::CommandBuffer cmd, uint32_t index,
+                                   uint32_t subIndex, uint32_t layer);
+    void recordUpload(vk::CommandBuffer cmd, vk::Image image, uint32_t layer,
+                      const std::vector<vk::BufferImageCopy> &regions);
+    void submitUploads(size_t frame);
+    vk::BufferImageCopy copyRegion(vk::DeviceSize offset, uint32_t layer,
+                                   vk::Extent2D extent,
+                                   vk::ImageAspectFlagBits aspect);
+    void latchDmaBufs(size_t frame);
+    void retainSlot(int index, int subIndex);
+    void releaseSlot(int index, int subIndex);
+    void retireFrame(size_t frame);
+    void retireCompletedFrames();
+    void countFrame(int index, std::atomic<uint64_t> StreamStats::*counter);
     void createSyncObjects();
 
     static void framebufferResizeCallback(GLFWwindow* window,
                                           int width, int height);
-    void cleanupSwapChain();
+    static void keyCallback(GLFWwindow *window, int key, int scancode,
+                            int action, int mods);
     void recreateSwapChain(int index);
+    void destroyRetiredSwapChains();
 };
 
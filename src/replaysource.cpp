@@ -0,0 +1,317 @@
+#include "replaysource.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+
+using RecordCallback = std::function<void(uint64_t offset,
+                                          const RecordHeader &header)>;
+
+// reads the headers of one segment, a record cut short by an interrupted
+// recording ends the segment
+static void walkSegment(int fd, const std::string &path, uint64_t size,
+                        const RecordCallback &callback)
+{
+    SegmentHeader segment;
+    if (pread(fd, &segment, sizeof(segment), 0) != sizeof(segment) ||
+        segment.magic != SegmentHeader::MAGIC ||
+        segment.version != RECORD_VERSION ||
+        segment.alignment != RECORD_ALIGNMENT) {
+        throw std::runtime_error(path + ": not a recording segment");
+    }
+
+    uint64_t offset = RECORD_ALIGNMENT;
+    while (offset + RECORD_ALIGNMENT <= size) {
+        RecordHeader header;
+        if (pread(fd, &header, sizeof(header), offset) != sizeof(header)) {
+            break;
+        }
+        if (header.magic != RecordHeader::MAGIC ||
+            header.recordSize < RECORD_ALIGNMENT + header.payloadSize ||
+            header.recordSize > size - offset) {
+            std::cerr << path << ": truncated at " << offset << std::endl;
+            break;
+        }
+        callback(offset, header);
+        offset += header.recordSize;
+    }
+}
+
+// calls fn(index, fd, path, size) for segment 0, 1, ... until one is missing
+static void forEachSegment(
+        const std::string &directory,
+        const std::function<void(uint32_t, int, const std::string &,
+                                 uint64_t)> &fn)
+{
+    for (uint32_t i = 0; ; i++) {
+        std::string path = segmentPath(directory, i);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            if (i == 0) {
+                throw std::runtime_error("failed to open " + path);
+            }
+            return;
+        }
+
+        struct stat st;
+        try {
+            if (fstat(fd, &st)) {
+                throw std::runtime_error("failed to stat " + path);
+            }
+            fn(i, fd, path, st.st_size);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
+}
+
+std::vector<uint32_t> ReplaySource::cameras(const std::string &directory)
+{
+    std::set<uint32_t> cameras;
+
+    forEachSegment(directory, [&cameras](uint32_t, int fd,
+                                         const std::string &path,
+                                         uint64_t size) {
+        walkSegment(fd, path, size,
+                    [&cameras](uint64_t, const RecordHeader &header) {
+            cameras.insert(header.camera);
+        });
+    });
+
+    return std::vector<uint32_t>(cameras.begin(), cameras.end());
+}
+
+ReplaySource::ReplaySource(const std::string &directory, uint32_t camera,
+                           Timing timing) :
+    m_directory(directory),
+    m_timing(timing)
+{
+    bool haveFormat = false;
+
+    try {
+        forEachSegment(directory, [&](uint32_t index, int fd,
+                                      const std::string &path,
+                                      uint64_t size) {
+            walkSegment(fd, path, size,
+                        [&](uint64_t offset, const RecordHeader &header) {
+                if (header.camera != camera) {
+                    return;
+                }
+
+                ImgFormat format(header.width, header.height,
+                                 static_cast<PixFormat>(header.pixelFormat));
+                if (!haveFormat) {
+                    m_imgFormat = format;
+                    m_bytesPerLine = header.bytesPerLine;
+                    haveFormat = true;
+                } else if (format.width != m_imgFormat.width ||
+                           format.height != m_imgFormat.height ||
+                           format.m_pixFmt != m_imgFormat.m_pixFmt) {
+                    throw std::runtime_error(path + ": format changes");
+                }
+                m_frameSize = std::max(m_frameSize,
+                                       static_cast<int>(header.payloadSize));
+
+                // the driver timestamp if there was one
+                IndexEntry entry;
+                entry.time = header.captureTime ? header.captureTime :
+                                                  header.dequeueTime;
+                entry.offset = offset;
+                entry.segment = index;
+                entry.sequence = header.sequence;
+                m_index.push_back(entry);
+            });
+
+            void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                throw std::runtime_error("failed to mmap " + path);
+            }
+            // playback reads each segment front to back
+            madvise(data, size, MADV_SEQUENTIAL);
+            m_segments.push_back(Segment{static_cast<uint8_t *>(data),
+                                         size});
+        });
+
+        if (m_index.empty()) {
+            throw std::runtime_error(directory + ": no frames of camera " +
+                                     std::to_string(camera));
+        }
+        // frames arrive in order, except across a clock change in mid
+        // recording; seek() needs them sorted
+        std::stable_sort(m_index.begin(), m_index.end(),
+                         [](const IndexEntry &a, const IndexEntry &b) {
+            return a.time < b.time;
+        });
+    } catch (...) {
+        for (const Segment &segment : m_segments) {
+            munmap(const_cast<uint8_t *>(segment.data), segment.size);
+        }
+        throw;
+    }
+}
+
+ReplaySource::~ReplaySource()
+{
+    if (m_timerFd != -1) {
+        ::close(m_timerFd);
+    }
+    for (const Segment &segment : m_segments) {
+        munmap(const_cast<uint8_t *>(segment.data), segment.size);
+    }
+}
+
+void ReplaySource::seek(uint64_t offset)
+{
+    IndexEntry key = {};
+    key.time = m_index.front().time + offset;
+
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), key,
+                               [](const IndexEntry &a, const IndexEntry &b) {
+        return a.time < b.time;
+    });
+    if (it == m_index.end()) {
+        throw std::runtime_error(m_directory + ": seek past the end");
+    }
+    m_first = it - m_index.begin();
+}
+
+void ReplaySource::open(const std::string &path, const ImgFormat &imgFormat,
+                        const std::vector<Buffer> &buffers)
+{
+    if (imgFormat.width != m_imgFormat.width ||
+        imgFormat.height != m_imgFormat.height ||
+        imgFormat.m_pixFmt != m_imgFormat.m_pixFmt) {
+        throw std::runtime_error(path + ": recorded in another format");
+    }
+    if (buffers.size() < 2 || buffers.size() > MAX_BUFFERS) {
+        throw std::runtime_error(path + ": invalid buffer count");
+    }
+    for (const auto &buffer : buffers) {
+        if (!buffer.start || buffer.length < static_cast<size_t>(m_frameSize)) {
+            throw std::runtime_error(path + ": buffer too small");
+        }
+    }
+    m_buffers = buffers;
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd == -1) {
+        throw std::runtime_error("timerfd_create failed");
+    }
+
+    const IndexEntry &first = m_index[m_first];
+    std::cout << path << ": replaying " << m_index.size() - m_first
+              << " frames, " << (m_index.back().time - first.time) / 1e9
+              << " s from " << m_directory
+              << (m_timing == Timing::Fast ? " as fast as possible" : "")
+              << std::endl;
+}
+
+void ReplaySource::start()
+{
+    m_freeBuffers.store(~0u >> (32 - m_buffers.size()),
+                        std::memory_order_release);
+    rewind();
+    arm(m_startTime);
+}
+
+void ReplaySource::stop()
+{
+    struct itimerspec spec = {};
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+        throw std::runtime_error("timerfd_settime failed");
+    }
+}
+
+void ReplaySource::rewind()
+{
+    m_position = m_first;
+    m_startTime = monotonicNs();
+    // the jump back is not a gap
+    resetSequence();
+}
+
+void ReplaySource::scheduleNext()
+{
+    if (m_position == m_index.size()) {
+        rewind();
+    }
+    if (m_timing == Timing::Fast) {
+        arm(m_startTime);
+    } else {
+        arm(m_startTime + m_index[m_position].time - m_index[m_first].time);
+    }
+}
+
+void ReplaySource::arm(uint64_t time)
+{
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = time / 1000000000ull;
+    spec.it_value.tv_nsec = time % 1000000000ull;
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+        throw std::runtime_error("timerfd_settime failed");
+    }
+}
+
+Frame ReplaySource::readFrame()
+{
+    Frame frame;
+    uint64_t expirations;
+
+    if (::read(m_timerFd, &expirations, sizeof(expirations)) !=
+            sizeof(expirations)) {
+        return frame;
+    }
+
+    uint32_t free = m_freeBuffers.load(std::memory_order_acquire);
+    int index;
+    do {
+        if (free == 0) {
+            // paced frames are dropped like a camera would, a fast replay
+            // waits for doneFrame() to rearm the timer
+            if (m_timing == Timing::Recorded) {
+                m_position++;
+                scheduleNext();
+            }
+            return frame;
+        }
+        index = __builtin_ctz(free);
+    } while (!m_freeBuffers.compare_exchange_weak(
+                free, free & ~(1u << index), std::memory_order_acquire));
+
+    const IndexEntry &entry = m_index[m_position++];
+    const uint8_t *record = m_segments[entry.segment].data + entry.offset;
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+
+    frame.captureTime = monotonicNs();
+    std::memcpy(m_buffers[index].start, record + RECORD_ALIGNMENT,
+                header.payloadSize);
+
+    frame.index = index;
+    frame.sequence = entry.sequence;
+    frame.bytesUsed = header.bytesUsed;
+    frame.dequeueTime = monotonicNs();
+    countFrame(entry.sequence);
+
+    scheduleNext();
+    return frame;
+}
+
+void ReplaySource::doneFrame(int index)
+{
+    m_freeBuffers.fetch_or(1u << index, std::memory_order_release);
+    if (m_timing == Timing::Fast) {
+        arm(1);
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "framesource.hpp"
+#include "recordformat.hpp"
+
+// Plays one camera of a --record directory back. The segments are mmapped
+// and indexed by timestamp when the source is created; frames are either
+// paced like they were captured or delivered as fast as the consumer hands
+// buffers back, in which case no frame is ever dropped. The recording loops.
+class ReplaySource : public FrameSource
+{
+public:
+    enum class Timing
+    {
+        Recorded,
+        Fast,
+    };
+
+    ReplaySource(const std::string &directory, uint32_t camera,
+                 Timing timing);
+    virtual ~ReplaySource();
+
+    ReplaySource(const ReplaySource &) = delete;
+    ReplaySource &operator=(const ReplaySource &) = delete;
+
+    // cameras with at least one frame in the recording
+    static std::vector<uint32_t> cameras(const std::string &directory);
+
+    // format of the recorded frames, open() has to ask for the same
+    ImgFormat imgFormat() const
+    {
+        return m_imgFormat;
+    }
+    // playback starts and loops at the first frame captured at least
+    // offset ns after the first one of this camera
+    void seek(uint64_t offset);
+
+    // path is only used in messages
+    void open(const std::string &path, const ImgFormat &imgFormat,
+              const std::vector<Buffer> &buffers) override;
+    int fd() const override
+    {
+        return m_timerFd;
+    }
+    uint32_t bytesPerLine() const override
+    {
+        return m_bytesPerLine;
+    }
+    int frameSize() const override
+    {
+        return m_frameSize;
+    }
+    void start() override;
+    void stop() override;
+    Frame readFrame() override;
+    void doneFrame(int index) override;
+
+private:
+    struct Segment
+    {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    // 24 bytes per frame, the headers stay on disk until played
+    struct IndexEntry
+    {
+        uint64_t time;
+        uint64_t offset;
+        uint32_t segment;
+        uint32_t sequence;
+    };
+
+    std::string m_directory;
+    Timing m_timing;
+    std::vector<Segment> m_segments;
+    std::vector<IndexEntry> m_index;
+    ImgFormat m_imgFormat;
+    uint32_t m_bytesPerLine = 0;
+    int m_frameSize = 0;
+
+    int m_timerFd = -1;
+    std::vector<Buffer> m_buffers;
+    // bit i set while buffer i is owned by the source
+    std::atomic<uint32_t> m_freeBuffers{0};
+    size_t m_first = 0;
+    size_t m_position = 0;
+    // monotonic time at which the frame m_index[m_first] is due
+    uint64_t m_startTime = 0;
+
+    void rewind();
+    void scheduleNext();
+    void arm(uint64_t time);
+};
@@ -1,13 +1,34 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
+#include "yuv.glsl"
+
+// RGBA, packed 4:2:2 or NV12 luma
 layout(binding = 1) uniform sampler2DArray texSampler;
+// NV12 CbCr
+layout(binding = 2) uniform sampler2DArray chromaSampler;
 
-layout(location = 0) in vec3 fragTexCoord;
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) flat in int fragLayer;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
-}
+    vec3 coord = vec3(fragTexCoord, fragLayer);
 
+    if (FORMAT == FORMAT_RGBA) {
+        outColor = texture(texSampler, coord);
+    } else if (FORMAT == FORMAT_NV12) {
+        float y = texture(texSampler, coord).r;
+        vec2 uv = texture(chromaSampler, coord).rg;
+        outColor = vec4(yuvToRgb(y, uv.r, uv.g), 1.0);
+    } else {
+        ivec2 size = textureSize(texSampler, 0).xy * ivec2(2, 1);
+        ivec2 pos = clamp(ivec2(fragTexCoord * vec2(size)),
+                          ivec2(0), size - 1);
+        vec4 texel = texelFetch(texSampler,
+                                ivec3(pos.x / 2, pos.y, fragLayer), 0);
+        outColor = vec4(unpack422(texel, pos.x), 1.0);
+    }
+}
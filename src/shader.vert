@@ -5,17 +5,23 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
+    // Render::MAX_TILES of each
+    vec4 rects[16];
+    ivec4 layers[4];
 } ubo;
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec2 inTexCoord;
 
-layout(location = 0) out vec3 fragTexCoord;
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out int fragLayer;
 
 void main()
 {
     // gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragTexCoord = vec3(inTexCoord, gl_InstanceIndex);
+    // one instance per layout tile, placed from the unit quad
+    vec4 rect = ubo.rects[gl_InstanceIndex];
+    gl_Position = vec4(rect.xy + inPosition * rect.zw, 0.0, 1.0);
+    fragTexCoord = inTexCoord;
+    fragLayer = ubo.layers[gl_InstanceIndex / 4][gl_InstanceIndex % 4];
 }
-
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+// lock-free ring for exactly one producer and one consumer thread
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    bool push(const T &item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+
+        if (tail - m_head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+
+        m_items[tail & (N - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = m_items[head & (N - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, N> m_items;
+    // head and tail on their own cache lines, each is written by one side
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Per camera frame accounting, written by whichever thread sees the event
+// and read from anywhere. Relaxed atomics, the counters are independent.
+struct StreamStats
+{
+    struct Snapshot
+    {
+        uint64_t dequeued = 0;
+        // sequence gaps, frames the driver had no buffer for
+        uint64_t dropped = 0;
+        // dequeued but replaced by a newer frame before being rendered
+        uint64_t superseded = 0;
+        // submitted to the GPU at least once
+        uint64_t displayed = 0;
+    };
+
+    alignas(64) std::atomic<uint64_t> dequeued{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> superseded{0};
+    std::atomic<uint64_t> displayed{0};
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot s;
+        s.dequeued = dequeued.load(std::memory_order_relaxed);
+        s.dropped = dropped.load(std::memory_order_relaxed);
+        s.superseded = superseded.load(std::memory_order_relaxed);
+        s.displayed = displayed.load(std::memory_order_relaxed);
+        return s;
+    }
+};
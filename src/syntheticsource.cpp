@@ -0,0 +1,232 @@
+#include "syntheticsource.hpp"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <opencv2/opencv.hpp>
+
+// BT.601 limited range, the inverse of yuv.glsl
+static void bgrToYuv(const cv::Vec3b &bgr, int &y, int &u, int &v)
+{
+    int b = bgr[0], g = bgr[1], r = bgr[2];
+
+    y = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+    u = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+    v = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+}
+
+SyntheticSource::SyntheticSource(Pattern pattern, double fps,
+                                 const std::string &imagePath) :
+    m_pattern(pattern),
+    m_fps(fps),
+    m_imagePath(imagePath)
+{
+    if (fps <= 0) {
+        throw std::runtime_error("invalid synthetic frame rate");
+    }
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    if (m_timerFd != -1) {
+        ::close(m_timerFd);
+    }
+}
+
+void SyntheticSource::open(const std::string &path, const ImgFormat &imgFormat,
+                           const std::vector<Buffer> &buffers)
+{
+    if (imgFormat.width <= 0 || imgFormat.height <= 0 ||
+        imgFormat.width % 2 || imgFormat.height % 2) {
+        throw std::runtime_error("invalid initialization params");
+    }
+
+    if (buffers.size() < 2 || buffers.size() > MAX_BUFFERS) {
+        throw std::runtime_error(path + ": invalid buffer count");
+    }
+
+    renderFrame(imgFormat.width, imgFormat.height, imgFormat.m_pixFmt);
+    for (const auto &buffer : buffers) {
+        if (!buffer.start || buffer.length < m_frame.size()) {
+            throw std::runtime_error(path + ": buffer too small");
+        }
+    }
+    m_buffers = buffers;
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd == -1) {
+        throw std::runtime_error("timerfd_create failed");
+    }
+
+    std::cout << path << ": synthetic " << imgFormat.width << "x"
+              << imgFormat.height << " at " << m_fps << " fps" << std::endl;
+}
+
+void SyntheticSource::renderFrame(int width, int height, PixFormat pixFmt)
+{
+    cv::Mat bgr;
+
+    switch (m_pattern) {
+    case Pattern::Bars: {
+        // 75% colour bars
+        static const cv::Vec3b bars[] = {
+            {191, 191, 191}, {0, 191, 191}, {191, 191, 0}, {0, 191, 0},
+            {191, 0, 191}, {0, 0, 191}, {191, 0, 0}, {0, 0, 0},
+        };
+        bgr.create(height, width, CV_8UC3);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                bgr.at<cv::Vec3b>(y, x) = bars[x * 8 / width];
+            }
+        }
+        break;
+    }
+    case Pattern::Gradient:
+        bgr.create(height, width, CV_8UC3);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                bgr.at<cv::Vec3b>(y, x) = cv::Vec3b(128, y * 255 / height,
+                                                    x * 255 / width);
+            }
+        }
+        break;
+    case Pattern::Image: {
+        cv::Mat image = cv::imread(m_imagePath, cv::IMREAD_COLOR);
+        if (image.empty()) {
+            throw std::runtime_error("failed to load " + m_imagePath);
+        }
+        cv::resize(image, bgr, cv::Size(width, height));
+        break;
+    }
+    }
+
+    switch (pixFmt) {
+    case PixFormat::XBGR32: {
+        // V4L2 XBGR32 is b, g, r, x in memory
+        cv::Mat bgra;
+        cv::cvtColor(bgr, bgra, cv::COLOR_BGR2BGRA);
+        m_bytesPerLine = width * 4;
+        m_frame.assign(bgra.data, bgra.data + bgra.total() * 4);
+        break;
+    }
+    case PixFormat::YUYV:
+    case PixFormat::UYVY: {
+        bool yuyv = pixFmt == PixFormat::YUYV;
+        m_bytesPerLine = width * 2;
+        m_frame.resize(m_bytesPerLine * height);
+        for (int y = 0; y < height; y++) {
+            uint8_t *dst = m_frame.data() + y * m_bytesPerLine;
+            for (int x = 0; x < width; x += 2) {
+                int y0, y1, u0, u1, v0, v1;
+                bgrToYuv(bgr.at<cv::Vec3b>(y, x), y0, u0, v0);
+                bgrToYuv(bgr.at<cv::Vec3b>(y, x + 1), y1, u1, v1);
+                uint8_t u = (u0 + u1 + 1) / 2;
+                uint8_t v = (v0 + v1 + 1) / 2;
+                if (yuyv) {
+                    dst[0] = y0, dst[1] = u, dst[2] = y1, dst[3] = v;
+                } else {
+                    dst[0] = u, dst[1] = y0, dst[2] = v, dst[3] = y1;
+                }
+                dst += 4;
+            }
+        }
+        break;
+    }
+    case PixFormat::NV12:
+    case PixFormat::NV12M: {
+        // CbCr plane right after the luma plane, as Render expects
+        m_bytesPerLine = width;
+        m_frame.resize(width * height * 3 / 2);
+        uint8_t *luma = m_frame.data();
+        uint8_t *chroma = luma + width * height;
+        for (int y = 0; y < height; y += 2) {
+            for (int x = 0; x < width; x += 2) {
+                int sumU = 0, sumV = 0;
+                for (int i = 0; i < 4; i++) {
+                    int py = y + i / 2, px = x + i % 2;
+                    int l, u, v;
+                    bgrToYuv(bgr.at<cv::Vec3b>(py, px), l, u, v);
+                    luma[py * width + px] = l;
+                    sumU += u;
+                    sumV += v;
+                }
+                chroma[y / 2 * width + x] = (sumU + 2) / 4;
+                chroma[y / 2 * width + x + 1] = (sumV + 2) / 4;
+            }
+        }
+        break;
+    }
+    }
+}
+
+void SyntheticSource::start()
+{
+    m_freeBuffers.store(~0u >> (32 - m_buffers.size()),
+                        std::memory_order_release);
+    m_sequence = 0;
+    resetSequence();
+
+    double period = 1e9 / m_fps;
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = static_cast<time_t>(period / 1e9);
+    spec.it_interval.tv_nsec = static_cast<long>(std::fmod(period, 1e9));
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(m_timerFd, 0, &spec, nullptr)) {
+        throw std::runtime_error("timerfd_settime failed");
+    }
+}
+
+void SyntheticSource::stop()
+{
+    struct itimerspec spec = {};
+    if (timerfd_settime(m_timerFd, 0, &spec, nullptr)) {
+        throw std::runtime_error("timerfd_settime failed");
+    }
+}
+
+Frame SyntheticSource::readFrame()
+{
+    Frame frame;
+    uint64_t expirations;
+
+    if (::read(m_timerFd, &expirations, sizeof(expirations)) !=
+            sizeof(expirations)) {
+        return frame;
+    }
+
+    // ticks we slept through are lost, like a driver running late
+    uint32_t sequence = m_sequence + expirations - 1;
+    m_sequence = sequence + 1;
+
+    // no buffer handed back in time, the frame is dropped
+    uint32_t free = m_freeBuffers.load(std::memory_order_acquire);
+    int index;
+    do {
+        if (free == 0) {
+            return frame;
+        }
+        index = __builtin_ctz(free);
+    } while (!m_freeBuffers.compare_exchange_weak(
+                free, free & ~(1u << index), std::memory_order_acquire));
+
+    frame.captureTime = monotonicNs();
+    std::memcpy(m_buffers[index].start, m_frame.data(), m_frame.size());
+
+    frame.index = index;
+    frame.sequence = sequence;
+    frame.bytesUsed = m_frame.size();
+    frame.dequeueTime = monotonicNs();
+    countFrame(sequence);
+
+    return frame;
+}
+
+void SyntheticSource::doneFrame(int index)
+{
+    m_freeBuffers.fetch_or(1u << index, std::memory_order_release);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "framesource.hpp"
+
+// Copies a pre-rendered frame into the caller's buffers at a fixed rate,
+// paced by a timerfd, to load the upload and render path without a camera.
+class SyntheticSource : public FrameSource
+{
+public:
+    enum class Pattern
+    {
+        Bars,
+        Gradient,
+        // decoded once from imagePath
+        Image,
+    };
+
+    SyntheticSource(Pattern pattern, double fps,
+                    const std::string &imagePath = std::string());
+    virtual ~SyntheticSource();
+
+    // path is only used in messages
+    void open(const std::string &path, const ImgFormat &imgFormat,
+              const std::vector<Buffer> &buffers) override;
+    int fd() const override
+    {
+        return m_timerFd;
+    }
+    uint32_t bytesPerLine() const override
+    {
+        return m_bytesPerLine;
+    }
+    int frameSize() const override
+    {
+        return m_frame.size();
+    }
+    void start() override;
+    void stop() override;
+    Frame readFrame() override;
+    void doneFrame(int index) override;
+
+private:
+    Pattern m_pattern;
+    double m_fps;
+    std::string m_imagePath;
+    int m_timerFd = -1;
+    uint32_t m_bytesPerLine = 0;
+    std::vector<Buffer> m_buffers;
+    // the frame every buffer receives, in the requested format
+    std::vector<uint8_t> m_frame;
+    // bit i set while buffer i is owned by the source
+    std::atomic<uint32_t> m_freeBuffers{0};
+    uint32_t m_sequence = 0;
+
+    void renderFrame(int width, int height, PixFormat pixFmt);
+};
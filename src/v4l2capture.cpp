@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <cerrno>
 
 V4l2Capture::V4l2Capture()
 {
@@ -16,24 +17,85 @@ V4l2Capture::V4l2Capture()
 
 V4l2Capture::~V4l2Capture()
 {
+    for (int fd : m_dmaBufs) {
+        ::close(fd);
+    }
     ::close(m_fd);
 }
 
 void V4l2Capture::open(const std::string &path, const ImgFormat &imgFormat,
-                       const std::array<Buffer, 4> &buffers)
+                       const std::vector<Buffer> &buffers)
+{
+    if (buffers.size() < 2 || buffers.size() > MAX_BUFFERS) {
+        throw std::runtime_error("invalid initialization params");
+    }
+
+    m_memory = V4L2_MEMORY_USERPTR;
+    m_bufferNum = buffers.size();
+
+    openDevice(path, imgFormat);
+    requestBuffers();
+
+    m_buffers = buffers;
+}
+
+void V4l2Capture::open(const std::string &path, const ImgFormat &imgFormat,
+                       int bufferNum)
+{
+    if (bufferNum < 2 || bufferNum > static_cast<int>(MAX_BUFFERS)) {
+        throw std::runtime_error("invalid initialization params");
+    }
+
+    m_memory = V4L2_MEMORY_MMAP;
+    m_bufferNum = bufferNum;
+
+    openDevice(path, imgFormat);
+    requestBuffers();
+}
+
+std::vector<int> V4l2Capture::exportBuffers()
+{
+    if (m_memory != V4L2_MEMORY_MMAP) {
+        throw std::runtime_error("VIDIOC_EXPBUF needs V4L2_MEMORY_MMAP");
+    }
+
+    if (!m_dmaBufs.empty()) {
+        return m_dmaBufs;
+    }
+
+    if (m_numPlanes != 1) {
+        throw std::runtime_error("VIDIOC_EXPBUF of multi-plane buffers");
+    }
+
+    for (int i = 0; i < m_bufferNum; i++) {
+        struct v4l2_exportbuffer expbuf = {};
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        expbuf.index = i;
+        expbuf.plane = 0;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+        if (ioctl(m_fd, VIDIOC_EXPBUF, &expbuf)) {
+            throw std::runtime_error("VIDIOC_EXPBUF error");
+        }
+        m_dmaBufs.push_back(expbuf.fd);
+    }
+
+    return m_dmaBufs;
+}
+
+void V4l2Capture::openDevice(const std::string &path,
+                             const ImgFormat &imgFormat)
 {
     int ret;
 
     if (imgFormat.width <= 0 ||
-        imgFormat.height <= 0 ||
-        buffers.size() < 2) {
+        imgFormat.height <= 0) {
         throw std::runtime_error("invalid initialization params");
     }
 
     m_width = imgFormat.width;
     m_height = imgFormat.height;
     m_pixFmt = static_cast<uint32_t>(imgFormat.m_pixFmt);
-    m_bufferNum = buffers.size();
 
     m_fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
     // m_fd = ::open(path.c_str(), O_RDWR);
@@ -54,7 +116,7 @@ void V4l2Capture::open(const std::string &path, const ImgFormat &imgFormat,
     fmt.fmt.pix_mp.width = m_width;
     fmt.fmt.pix_mp.height = m_height;
     fmt.fmt.pix_mp.pixelformat = m_pixFmt;
-    fmt.fmt.pix_mp.num_planes = 1;
+    // the driver fills in num_planes, e.g. 2 for NV12M
     if (ioctl(m_fd, VIDIOC_S_FMT, &fmt)) {
         throw std::runtime_error("failed to set format");
     }
@@ -66,15 +128,29 @@ void V4l2Capture::open(const std::string &path, const ImgFormat &imgFormat,
     }
     std::cout << "\twidth: " << fmt.fmt.pix_mp.width
               << "\theight: " << fmt.fmt.pix_mp.height << std::endl;
-    std::cout << "\timage size: " << fmt.fmt.pix_mp.plane_fmt[0].sizeimage
-              << std::endl;
+    m_numPlanes = fmt.fmt.pix_mp.num_planes;
+    if (m_numPlanes < 1 || m_numPlanes > VIDEO_MAX_PLANES) {
+        throw std::runtime_error("invalid number of planes");
+    }
+    m_frameSize = 0;
+    for (int i = 0; i < m_numPlanes; i++) {
+        m_planeSizes[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+        m_frameSize += m_planeSizes[i];
+        std::cout << "\tplane " << i << " size: " << m_planeSizes[i]
+                  << std::endl;
+    }
     std::cout << "\tpixelformat: "
               << static_cast<char>(fmt.fmt.pix_mp.pixelformat & 0xff)
               << static_cast<char>(fmt.fmt.pix_mp.pixelformat >> 8 & 0xff)
               << static_cast<char>(fmt.fmt.pix_mp.pixelformat >> 16 & 0xff)
               << static_cast<char>(fmt.fmt.pix_mp.pixelformat >> 24 & 0xff)
               << std::endl;
-    m_frameSize =fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+    if (fmt.fmt.pix_mp.pixelformat != m_pixFmt ||
+        static_cast<int>(fmt.fmt.pix_mp.width) != m_width ||
+        static_cast<int>(fmt.fmt.pix_mp.height) != m_height) {
+        throw std::runtime_error(path + ": format not supported");
+    }
+    m_bytesPerLine = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
 
     struct v4l2_streamparm parm = {};
     parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
@@ -83,42 +159,72 @@ void V4l2Capture::open(const std::string &path, const ImgFormat &imgFormat,
     }
     std::cout << "\tfps: " << parm.parm.capture.timeperframe.denominator
               << std::endl;
+}
 
+void V4l2Capture::requestBuffers()
+{
     struct v4l2_requestbuffers req = {};
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     req.count = m_bufferNum;
-    req.memory = V4L2_MEMORY_USERPTR;
+    req.memory = m_memory;
     if (ioctl(m_fd, VIDIOC_REQBUFS, &req)) {
-        throw std::runtime_error("do not support V4L2_MEMORY_USERPTR");
+        throw std::runtime_error(m_memory == V4L2_MEMORY_MMAP ?
+                                 "do not support V4L2_MEMORY_MMAP" :
+                                 "do not support V4L2_MEMORY_USERPTR");
     }
     if (req.count < 2) {
         throw std::runtime_error("Insufficient buffer memory");
     }
-
-    m_buffers = buffers;
+    if (static_cast<int>(req.count) != m_bufferNum) {
+        throw std::runtime_error("driver changed the buffer count");
+    }
 }
 
-void V4l2Capture::start()
+void V4l2Capture::queueBuffer(int index)
 {
-    for (int i = 0; i < m_bufferNum; i++) {
-        struct v4l2_buffer buf = {};
-        struct v4l2_plane plane = {};
+    struct v4l2_buffer buf = {};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+
+    // userptr planes are laid out back to back in the caller's buffer
+    if (m_memory == V4L2_MEMORY_USERPTR) {
+        char *start = static_cast<char *>(m_buffers.at(index).start);
+        size_t remaining = m_buffers.at(index).length;
+
+        for (int i = 0; i < m_numPlanes; i++) {
+            size_t length = i == m_numPlanes - 1 ? remaining :
+                                                   m_planeSizes[i];
+            if (length > remaining) {
+                throw std::runtime_error("userptr buffer too small");
+            }
+
+            planes[i].length = length;
+            planes[i].m.userptr = reinterpret_cast<unsigned long>(start);
+            start += length;
+            remaining -= length;
+        }
+    }
 
-        plane.length = m_buffers.at(i).length;
-        plane.m.userptr = reinterpret_cast<unsigned long>(m_buffers.at(i).start);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = m_memory;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = m_numPlanes;
 
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        buf.memory = V4L2_MEMORY_USERPTR;
-        buf.index = i;
-        buf.m.planes = &plane;
-        buf.length = 1;
+    if (ioctl(m_fd, VIDIOC_QBUF, &buf)) {
+        throw std::runtime_error(std::string("VIDIOC_QBUF error: ") +
+                                 std::strerror(errno));
+    }
+}
 
-        if (ioctl(m_fd, VIDIOC_QBUF, &buf)) {
-            std::cout << errno << std::endl;
-            throw std::runtime_error("VIDIOC_QBUF error");
-        }
+void V4l2Capture::start()
+{
+    for (int i = 0; i < m_bufferNum; i++) {
+        queueBuffer(i);
     }
 
+    // the sequence restarts with every STREAMON
+    resetSequence();
+
     enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     if (ioctl(m_fd, VIDIOC_STREAMON, &type)) {
         throw std::runtime_error("VIDIOC_STREAMON error");
@@ -134,42 +240,44 @@ void V4l2Capture::stop()
     }
 }
 
-int V4l2Capture::readFrame()
+Frame V4l2Capture::readFrame()
 {
+    Frame frame;
     struct v4l2_buffer buf = {};
-    struct v4l2_plane plane = {};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
 
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    buf.memory = V4L2_MEMORY_USERPTR;
-    buf.length = 1;
-    buf.m.planes = &plane;
+    buf.memory = m_memory;
+    buf.length = m_numPlanes;
+    buf.m.planes = planes;
 
     if (ioctl(m_fd, VIDIOC_DQBUF, &buf)) {
         // std::cout << "no buffer " << errno << std::endl;
-        return -1;
+        return frame;
     }
 
-    return buf.index;
+    frame.index = buf.index;
+    frame.sequence = buf.sequence;
+    frame.dequeueTime = monotonicNs();
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        frame.captureTime =
+            static_cast<uint64_t>(buf.timestamp.tv_sec) * 1000000000ull +
+            buf.timestamp.tv_usec * 1000ull;
+    }
+    for (uint32_t i = 0; i < buf.length; i++) {
+        frame.bytesUsed += planes[i].bytesused - planes[i].data_offset;
+    }
+
+    // the driver skips sequence numbers for frames it had no buffer for
+    countFrame(frame.sequence);
+
+    return frame;
 }
 
 void V4l2Capture::doneFrame(int index)
 {
-    struct v4l2_buffer buf = {};
-    struct v4l2_plane plane = {};
-
-    plane.length = m_buffers.at(index).length;
-    plane.m.userptr = reinterpret_cast<unsigned long>(m_buffers.at(index).start);
-
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    buf.memory = V4L2_MEMORY_USERPTR;
-    buf.index = index;
-    buf.m.planes = &plane;
-    buf.length = 1;
-
-    if (ioctl(m_fd, VIDIOC_QBUF, &buf)) {
-        throw std::runtime_error("VIDIOC_QBUF error");
-    }
-
+    queueBuffer(index);
 }
 
 void V4l2Capture::enumFormat()
@@ -177,7 +285,7 @@ void V4l2Capture::enumFormat()
     int ret;
 
     struct v4l2_fmtdesc fmtdesc = {};
-    fmtdesc.type = V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     for (int i = 0; ;i++) {
         fmtdesc.index = i;
 
@@ -186,7 +294,9 @@ void V4l2Capture::enumFormat()
             break;
 
         std::cout << "index: " << i << ", pixelformat: "
-                  << std::string(reinterpret_cast<char *>(&fmtdesc.pixelformat));
+                  << std::string(reinterpret_cast<char *>(&fmtdesc.pixelformat),
+                                 sizeof(fmtdesc.pixelformat))
+                  << std::endl;
     }
 }
 
@@ -5,66 +5,55 @@
 #include <vector>
 #include <array>
 
-class V4l2Capture
+#include "framesource.hpp"
+
+class V4l2Capture : public FrameSource
 {
 public:
-    enum class PixFormat
-    {
-        XBGR32 = V4L2_PIX_FMT_XBGR32,
-    };
-
-    struct ImgFormat
-    {
-        int width;
-        int height;
-        PixFormat m_pixFmt;
-
-        ImgFormat(int width = -1, int height = -1,
-                  PixFormat pixFmt = PixFormat::XBGR32) :
-            width(width),
-            height(height),
-            m_pixFmt(pixFmt)
-        {}
-    };
-
-    struct Buffer
-    {
-        void *start;
-        size_t length;
-
-        Buffer(void *start_ = nullptr, size_t length_ = 0) :
-            start(start_),
-            length(length_)
-        {}
-
-        Buffer& operator=(const Buffer& other)
-        {
-            if (this != &other) {
-                start = other.start;
-                length = other.length;
-            }
-            return *this;
-        }
-    };
-
     V4l2Capture();
     virtual ~V4l2Capture();
 
+    // V4L2_MEMORY_USERPTR into caller provided buffers
+    void open(const std::string &path, const ImgFormat &imgFormat,
+              const std::vector<Buffer> &buffers) override;
+    // V4L2_MEMORY_MMAP, buffers are driver owned, see exportBuffers()
     void open(const std::string &path, const ImgFormat &imgFormat,
-              const std::array<Buffer, 4> &buffers);
-    void start();
-    void stop();
-    int readFrame();
-    void doneFrame(int index);
+              int bufferNum);
+    // dmabuf fds of the mmap buffers, still owned by V4l2Capture
+    std::vector<int> exportBuffers();
+    uint32_t bytesPerLine() const override
+    {
+        return m_bytesPerLine;
+    }
+    int fd() const override
+    {
+        return m_fd;
+    }
+    int frameSize() const override
+    {
+        return m_frameSize;
+    }
+    void start() override;
+    void stop() override;
+    Frame readFrame() override;
+    void doneFrame(int index) override;
 
 private:
     int m_fd = -1;
     int m_width;
     int m_height;
     int m_frameSize;
+    int m_numPlanes = 1;
+    std::array<uint32_t, VIDEO_MAX_PLANES> m_planeSizes;
+    uint32_t m_bytesPerLine;
     uint32_t m_pixFmt;
+    uint32_t m_memory = V4L2_MEMORY_USERPTR;
     int m_bufferNum;
-    std::array<Buffer, 4> m_buffers;
+    std::vector<Buffer> m_buffers;
+    std::vector<int> m_dmaBufs;
 
+    void openDevice(const std::string &path, const ImgFormat &imgFormat);
+    void requestBuffers();
+    void queueBuffer(int index);
     void enumFormat();
 };
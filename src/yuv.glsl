@@ -0,0 +1,30 @@
+// Shared by the fragment shaders, pixel format is specialization constant 1
+// and matches Render::shaderFormat().
+layout(constant_id = 1) const int FORMAT = 0;
+
+const int FORMAT_RGBA = 0;
+const int FORMAT_YUYV = 1;
+const int FORMAT_UYVY = 2;
+const int FORMAT_NV12 = 3;
+
+// BT.601 limited range
+vec3 yuvToRgb(float y, float u, float v)
+{
+    y = 1.164 * (y - 0.0625);
+    u -= 0.5;
+    v -= 0.5;
+
+    return vec3(y + 1.596 * v,
+                y - 0.392 * u - 0.813 * v,
+                y + 2.017 * u);
+}
+
+// packed 4:2:2 texel holding two pixels, x is the output pixel column
+vec3 unpack422(vec4 texel, int x)
+{
+    if (FORMAT == FORMAT_YUYV) {
+        return yuvToRgb((x & 1) == 0 ? texel.r : texel.b, texel.g, texel.a);
+    }
+
+    return yuvToRgb((x & 1) == 0 ? texel.g : texel.a, texel.r, texel.b);
+}